@@ -1,10 +1,12 @@
 #pragma once
-#include <fstream>
 #include <algorithm>
 #include <string>
-#include <sstream>
 #include <vector>
 #include <cmath>
+#include <cstring>
+#include <future>
+#include "ThreadPool.h"
+#include "MappedFile.h"
 using namespace std;
 
 #define PRIMARY       		0x4D4D	// Primary Chunk, at the beginning of each file
@@ -54,36 +56,34 @@ namespace Simple3DS {
         float nx, ny, nz; // (Generated)
     } Normal;
 
+    // Every attribute in its own contiguous array, filled straight from the
+    // chunk payloads; vertices and texture coordinates share indices. Normals
+    // do too, unless smoothing groups split them: then normalIndices holds
+    // the normal of every face corner (three per triangle).
     class Object {
     private:
-        vector<Triangle*> triangles;
-        vector<Vertex*> vertices;
-        vector<TextureCoord*> texuvs;
-        vector<Normal*> normals;
+        vector<Triangle> triangles;
+        vector<Vertex> vertices;
+        vector<TextureCoord> texuvs;
+        vector<Normal> normals;
+        vector<u32> normalIndices;
+        // bit mask of the groups of every triangle, empty if the file has none
+        vector<u32> smoothingGroups;
     public:
-        inline void addTriangle(Triangle* tri) { triangles.push_back(tri); }
-        inline void addVertex(Vertex* vert) { vertices.push_back(vert); }
-        inline void addTextureCoord(TextureCoord* tc) { texuvs.push_back(tc); }
-        inline void addNormal(Normal* nrm) { normals.push_back(nrm); }
-        inline void resizeNormals(size_t newSize) { normals.resize(newSize); }
-        inline Triangle* getTriangle(int index) { return triangles[index]; }
-        inline Vertex* getVertex(int index) { return vertices[index]; }
-        inline TextureCoord* getTextureCoord(int index) { return texuvs[index]; }
-        inline Normal* getNormal(int index) { return normals[index]; }
+        inline vector<Triangle>& getTriangles() { return triangles; }
+        inline vector<Vertex>& getVertices() { return vertices; }
+        inline vector<TextureCoord>& getTextureCoords() { return texuvs; }
+        inline vector<Normal>& getNormals() { return normals; }
+        inline vector<u32>& getNormalIndices() { return normalIndices; }
+        inline vector<u32>& getSmoothingGroups() { return smoothingGroups; }
+        inline Triangle* getTriangle(int index) { return &triangles[index]; }
+        inline Vertex* getVertex(int index) { return &vertices[index]; }
+        inline TextureCoord* getTextureCoord(int index) { return &texuvs[index]; }
+        inline Normal* getNormal(int index) { return &normals[index]; }
         inline size_t getNumOfTriangles() { return triangles.size(); };
         inline size_t getNumOfVertices() { return vertices.size(); };
         inline size_t getNumOfTexCoords() { return texuvs.size(); };
         inline size_t getNumOfNormals() { return normals.size(); };
-        inline ~Object() {
-            for (size_t i = 0; i < triangles.size(); i++)
-                delete triangles[i];
-            for (size_t i = 0; i < vertices.size(); i++)
-                delete vertices[i];
-            for (size_t i = 0; i < texuvs.size(); i++)
-                delete texuvs[i];
-            for (size_t i = 0; i < normals.size(); i++)
-                delete normals[i];
-        }
     };
 
     class Material {
@@ -117,196 +117,80 @@ namespace Simple3DS {
         }
     };
 
-    class Chunk {
-    protected:
+    // A chunk of a mapped file: its id and the payload after the 6 byte header
+    struct ChunkView {
         u16 id;
-        u32 len;
-        streampos filePosition;
-        vector<Chunk*> children;
-        Chunk* parent;
-        string storedName;
-
-        vector<int> hasSubNodes{
-            OBJECTINFO, OBJECT, MATERIAL, OBJECT_MESH,
-            OBJECT_FACES, MATMAP, KEYFRAMES
-        };
-        inline string parse_string(ifstream& ifs) {
-            char c = ' ';
-            string str;
-            while (c != 0) {
-                ifs.read(&c, 1);
-                if (c != 0) str += c;
-            }
-            return str;
-        }
-        inline int parse_OBJECT(Chunk* child, ifstream& ifs, ModelData& data) {
-            data.addObject(new Object());
-            child->storedName = parse_string(ifs);
-            return child->storedName.size() + 1;
-        }
-        inline int parse_OBJECT_FACES(Chunk* child, ifstream& ifs, ModelData& data) {
-            u16 numFaces;
-            Object* obj = data.getObject(data.getNumOfObjects() - 1);
-            ifs.read((char*)&numFaces, 2);
-            for (size_t i = 0; i < numFaces; i++) {
-                Triangle* tri = new Triangle;
-                u16 v;
-                ifs.read((char*)&tri->index[0], 2); // First Face Index
-                ifs.read((char*)&tri->index[1], 2); // Second Face Index
-                ifs.read((char*)&tri->index[2], 2); // Third Face Index
-                ifs.read((char*)&v, 2);	// Some visibilty flag (Not needed)
-                obj->addTriangle(tri);
-            }
-            return 2 + numFaces * 8;
-        }
-        inline void parse_OBJECT_VERTICES(Chunk* child, ifstream& ifs, ModelData& data) {
-            u16 numVerts;
-            Object* obj = data.getObject(data.getNumOfObjects() - 1);
-            ifs.read((char*)&numVerts, 2);
-            for (size_t i = 0; i < numVerts; i++) {
-                Vertex* v = new Vertex;
-                ifs.read((char*)&v->x, 4);		// x position of vertex
-                if (!data.swapUpAxis) {			// Pass in as normal values.
-                    ifs.read((char*)&v->y, 4);	// y position of vertex
-                    ifs.read((char*)&v->z, 4);	// z position of vertex
-                }
-                else {				// Need to swap the Y & Z positions.
-                    ifs.read((char*)&v->z, 4);	// y position of vertex
-                    ifs.read((char*)&v->y, 4);	// z position of vertex
-                    v->z = -v->z;			// Negate z value
-                }
-                obj->addVertex(v);
-            }
-        }
-        inline void parse_OBJECT_UV(Chunk* child, ifstream& ifs, ModelData& data) {
-            u16 numTexCords;
-            Object* obj = data.getObject(data.getNumOfObjects() - 1);
-            ifs.read((char*)&numTexCords, 2);
-            for (size_t i = 0; i < numTexCords; i++) {
-                TextureCoord* tc = new TextureCoord;
-                ifs.read((char*)&tc->u, 4);
-                ifs.read((char*)&tc->v, 4);
-                obj->addTextureCoord(tc);
-            }
-        }
-        inline int parse_MATMAP(Chunk* child, ifstream& ifs, ModelData& data) {
-            u16 a, b, c, d;
-            ifs.read((char*)&a, 2);
-            ifs.read((char*)&b, 2);
-            ifs.read((char*)&c, 2);
-            ifs.read((char*)&d, 2);
-            return 8;
-        }
+        const char* data;
+        size_t size;
+    };
+
+    // Walks the chunks stored back to back in a range of a mapped file,
+    // without allocating or copying; the children of a chunk are walked by an
+    // iterator over its payload, and a chunk that is not needed is skipped by
+    // its length without touching its bytes. A length running past the end
+    // of the range is cut at it.
+    class ChunkIterator {
+    private:
+        const char* cursor;
+        const char* end;
     public:
-        inline ~Chunk() {
-            for (size_t i = 0; i < children.size(); i++)
-                delete children[i];
-        }
-        inline void read(ifstream& ifs) {
-            filePosition = ifs.tellg();
-            ifs.read((char*)&id, 2);
-            ifs.read((char*)&len, 4);
-        }
-        inline bool checkIfHasSubNodes(u16 id) {
-            for (size_t i = 0; i < hasSubNodes.size(); i++)
-                if (id == hasSubNodes[i])
-                    return true;
-            return false;
-        }
-        inline void readChildren(ifstream& ifs, int readLeft, ModelData& data) {
-            while (readLeft > 0) {
-                Chunk* child = new Chunk();
-                child->parent = this;
-                child->read(ifs);
-                if (checkIfHasSubNodes(child->id)) {
-                    int readLeftChild = child->len - 6;
-                    switch (child->id) {
-                    case OBJECT:		readLeftChild -= parse_OBJECT(child, ifs, data); break;
-                    case OBJECT_FACES:	readLeftChild -= parse_OBJECT_FACES(child, ifs, data); break;
-                    case MATMAP:		readLeftChild -= parse_MATMAP(child, ifs, data); break;
-                    case MATERIAL:		data.addMaterial(new Material()); break;
-                    }
-                    child->readChildren(ifs, readLeftChild, data);
-                }
-                else {
-                    switch (child->id) {
-                    case OBJECT_VERTICES:	parse_OBJECT_VERTICES(child, ifs, data); break;
-                    case OBJECT_UV:			parse_OBJECT_UV(child, ifs, data); break;
-                    case MATNAME:
-                        data.getMaterial(data.getNumOfMaterials() - 1)->setName(parse_string(ifs)); break;
-                    case MATMAPFILE:
-                        if (this->id == MATMAP)
-                            data.getMaterial(data.getNumOfMaterials() - 1)->setFileName(parse_string(ifs)); break;
-                    }
-                }
-                ifs.seekg((int)child->filePosition + (child->len), ios::beg);
-                readLeft -= child->len;
-                children.push_back(child);
-            }
-        }
-        inline u16 getId() { return id; }
-        inline u16 getLength() { return len; }
-        inline size_t getNumberOfChildren() { return children.size(); }
-        inline string to_string() {
-            stringstream ss;
-            ss << hex << getName() << uppercase << ": " << filePosition << " [" << getId() << ", " << getLength() << "]" << dec;
-            if (children.size() > 0) {
-                ss << " {" << endl;
-                for (size_t i = 0; i < children.size(); i++) {
-                    ss << children[i]->to_string() << endl;
-                }
-                ss << "}";
-            }
-            return ss.str();
-        }
-        inline string getName() {
-            switch (id) {
-            case PRIMARY:			return "Root";
-            case VERSION:			return "Version";
-            case OBJECTINFO:		return "Object Info";
-            case OBJECT_MESH:		return "Object Mesh";
-            case KEYFRAMES:			return "Keyframes";
-            case MATERIAL:			return "Material";
-            case OBJECT:			return "Object";
-            case MESHVERSION:		return "Mesh Version";
-            case OBJECT_VERTICES:		return "Object Vertices";
-            case OBJECT_FACES:		return "Object Faces";
-            case OBJECT_MATERIAL:		return "Object Materials";
-            case OBJECT_UV:			return "Object UV";
-            case OBJECT_SMOOTH_GRP:		return "Smooth Group";
-            case OBJECT_LOCAL_COORD:	return "Local Coordinates";
-            case OBJECT_VISIBLE:		return "Object Visibilty?";
-            case MATNAME:			return "Mat Name";
-            case MATDIFFUSE:		return "Mat Diffuse";
-            case MATMAP:			return "Mat Texture Map";
-            case MATMAPFILE:		return "Mat Texture File";
-            case MATMAPPARAM:		return "Mat Texture Parameters";
-            case MATTRANSP:			return "Mat Transparency";
-            default:			return "UNKNOWN";
-            }
+        inline ChunkIterator(const char* begin, const char* end) : cursor(begin), end(end) {}
+        // children of parent, starting offset bytes into its payload
+        inline explicit ChunkIterator(const ChunkView& parent, size_t offset = 0)
+            : cursor(parent.data + (offset < parent.size ? offset : parent.size)), end(parent.data + parent.size) {}
+
+        inline bool next(ChunkView& chunk) {
+            if (end - cursor < 6)
+                return false;
+            u32 len;
+            memcpy(&chunk.id, cursor, 2);
+            memcpy(&len, cursor + 2, 4);
+            if (len < 6)
+                return false;
+            size_t size = len < (size_t)(end - cursor) ? len : (size_t)(end - cursor);
+            chunk.data = cursor + 6;
+            chunk.size = size - 6;
+            cursor += size;
+            return true;
         }
     };
 
+    // Bytes taken by the zero terminated string at the start of chunk,
+    // terminator included
+    inline size_t StringSize(const ChunkView& chunk) {
+        const char* terminator = (const char*)memchr(chunk.data, 0, chunk.size);
+        return terminator ? terminator - chunk.data + 1 : chunk.size;
+    }
+
+    inline string ParseString(const ChunkView& chunk) {
+        const char* terminator = (const char*)memchr(chunk.data, 0, chunk.size);
+        return string(chunk.data, terminator ? terminator : chunk.data + chunk.size);
+    }
+
+    // How the faces around a vertex are weighted into its normal
+    enum NormalWeighting {
+        // by the area of each face, as the original loader did
+        WeightByArea,
+        // by the angle of each face at the vertex, so splitting a face does
+        // not pull the normal towards it
+        WeightByAngle
+    };
+
     /*
     Class that calculates the normals for the model
     Special thanks to Ben Humphrey (DigiBen) for writing his original code in his .3ds loader.
+    Every face scatters its normal into a list per vertex, in face order, and
+    every vertex then sums its list: linear in the faces and vertices, and the
+    same sums in the same order as the original loop over every face for
+    every vertex, so the area weighted normals are identical.
     */
     class NormalMath {
+    public:
+        // objects with fewer faces or vertices are not worth a thread pool
+        // (an object holds at most 65535 faces)
+        static const size_t ParallelThreshold = 1 << 14;
+
     private:
-        static inline vector<float> MidPoint(float x1, float y1, float z1, float x2, float y2, float z2) {
-            vector<float> result;
-            result.push_back(x1 - x2);
-            result.push_back(y1 - y2);
-            result.push_back(z1 - z2);
-            return result;
-        }
-        static inline vector<float> AddPoints(vector<float> v, Normal* nrm) {
-            vector<float> result;
-            result.push_back(v[0] + nrm->nx);
-            result.push_back(v[1] + nrm->ny);
-            result.push_back(v[2] + nrm->nz);
-            return result;
-        }
         static inline Normal CrossProduct(float x1, float y1, float z1, float x2, float y2, float z2) {
             Normal normal;
             normal.nx = ((y1 * z2) - (z1 * y2));
@@ -314,76 +198,375 @@ namespace Simple3DS {
             normal.nz = ((x1 * y2) - (y1 * x2));
             return normal;
         }
-        static inline Normal* DivideVectorByScaler(vector<float> v, float Scaler) {
-            Normal* normal = new Normal();
-            normal->nx = v[0] / Scaler;
-            normal->ny = v[1] / Scaler;
-            normal->nz = v[2] / Scaler;
-            return normal;
-        }
         static inline void Normalize(Normal* nrm) {
             float Magnitude = sqrt(nrm->nx*nrm->nx + nrm->ny*nrm->ny + nrm->nz*nrm->nz);
             nrm->nx /= Magnitude;
             nrm->ny /= Magnitude;
             nrm->nz /= Magnitude;
         }
-    public:
-        static inline void CalculateNormals(ModelData& data) {
-            for (size_t i = 0; i < data.getNumOfObjects(); i++) {
-                Object* obj = data.getObject(i);
-                vector<Normal> pNormals(obj->getNumOfTriangles());
-                vector<Normal> pTempNormals(obj->getNumOfTriangles());
-
-                for (size_t f = 0; f < obj->getNumOfTriangles(); f++) {
-                    Vertex* v0 = obj->getVertex(obj->getTriangle(f)->index[0]);
-                    Vertex* v1 = obj->getVertex(obj->getTriangle(f)->index[1]);
-                    Vertex* v2 = obj->getVertex(obj->getTriangle(f)->index[2]);
-
-                    vector<float> mv0 = MidPoint(v0->x, v0->y, v0->z, v2->x, v2->y, v2->z);
-                    vector<float> mv1 = MidPoint(v2->x, v2->y, v2->z, v1->x, v1->y, v1->z);
-
-                    Normal vNormal = CrossProduct(mv0[0], mv0[1], mv0[2], mv1[0], mv1[1], mv1[2]);
-                    pTempNormals[f] = vNormal;
+        // angle at a between the edges to b and c
+        static inline float Angle(const Vertex* a, const Vertex* b, const Vertex* c) {
+            float ux = b->x - a->x, uy = b->y - a->y, uz = b->z - a->z;
+            float vx = c->x - a->x, vy = c->y - a->y, vz = c->z - a->z;
+            float lengths = sqrt((ux*ux + uy*uy + uz*uz) * (vx*vx + vy*vy + vz*vz));
+            if (lengths == 0.0f)
+                return 0.0f;
+            float cosine = (ux*vx + uy*vy + uz*vz) / lengths;
+            return acos(cosine < -1.0f ? -1.0f : (cosine > 1.0f ? 1.0f : cosine));
+        }
+
+        // Run body(first, last) over [0, count), split over threadCount workers
+        template <class F>
+        static inline void ForRanges(size_t count, unsigned int threadCount, F body) {
+            if (threadCount <= 1 || count < ParallelThreshold) {
+                body((size_t)0, count);
+                return;
+            }
+            size_t rangeCount = threadCount * 4;
+            size_t rangeSize = count / rangeCount + 1;
+            ThreadPool pool(threadCount);
+            vector<future<void> > pending;
+            for (size_t first = 0; first < count; first += rangeSize) {
+                size_t last = first + rangeSize < count ? first + rangeSize : count;
+                pending.push_back(pool.enqueue([&body, first, last]() { body(first, last); }));
+            }
+            for (size_t i = 0; i < pending.size(); i++)
+                pending[i].get();
+        }
+
+        // sum of the corners around a vertex divided by minus their count and
+        // normalized, as the original loader did
+        static inline Normal Average(const float sum[3], u32 count) {
+            float shared = float(-(int)count);
+            Normal normal;
+            normal.nx = sum[0] / shared;
+            normal.ny = sum[1] / shared;
+            normal.nz = sum[2] / shared;
+            Normalize(&normal);
+            return normal;
+        }
+
+        static inline void CalculateNormals(Object* obj, NormalWeighting weighting, unsigned int threadCount) {
+            const vector<Triangle>& triangles = obj->getTriangles();
+            const vector<Vertex>& vertices = obj->getVertices();
+            size_t numFaces = triangles.size();
+            size_t numVerts = vertices.size();
+
+            // what every corner adds to the normal of its vertex
+            vector<Normal> corners(numFaces * 3);
+            ForRanges(numFaces, threadCount, [&triangles, &vertices, &corners, numVerts, weighting](size_t first, size_t last) {
+                for (size_t f = first; f < last; f++) {
+                    const u16* index = triangles[f].index;
+                    if (index[0] >= numVerts || index[1] >= numVerts || index[2] >= numVerts)
+                        continue;
+                    const Vertex* v0 = &vertices[index[0]];
+                    const Vertex* v1 = &vertices[index[1]];
+                    const Vertex* v2 = &vertices[index[2]];
+
+                    // as long as twice the area of the face
+                    Normal vNormal = CrossProduct(v0->x - v2->x, v0->y - v2->y, v0->z - v2->z,
+                        v2->x - v1->x, v2->y - v1->y, v2->z - v1->z);
+                    if (weighting == WeightByArea) {
+                        corners[f * 3] = corners[f * 3 + 1] = corners[f * 3 + 2] = vNormal;
+                        continue;
+                    }
+                    // a face without area has no direction, and would
+                    // spread NaN into its vertices
+                    if (vNormal.nx == 0.0f && vNormal.ny == 0.0f && vNormal.nz == 0.0f)
+                        continue;
                     Normalize(&vNormal);
-                    pNormals[f] = vNormal;
+                    float angles[3] = { Angle(v0, v1, v2), Angle(v1, v2, v0), Angle(v2, v0, v1) };
+                    for (int k = 0; k < 3; k++) {
+                        corners[f * 3 + k].nx = vNormal.nx * angles[k];
+                        corners[f * 3 + k].ny = vNormal.ny * angles[k];
+                        corners[f * 3 + k].nz = vNormal.nz * angles[k];
+                    }
+                }
+            });
+
+            // the corners of every vertex as one flat array, in face order; a
+            // face that uses a vertex twice counts once
+            vector<u32> cornerStart(numVerts + 1, 0);
+            vector<u32> vertexCorners;
+            for (int pass = 0; pass < 2; pass++) {
+                for (size_t f = 0; f < numFaces; f++) {
+                    const u16* index = triangles[f].index;
+                    if (index[0] >= numVerts || index[1] >= numVerts || index[2] >= numVerts)
+                        continue;
+                    for (int k = 0; k < 3; k++) {
+                        if ((k > 0 && index[k] == index[0]) || (k > 1 && index[k] == index[1]))
+                            continue;
+                        if (pass == 0)
+                            cornerStart[index[k] + 1]++;
+                        else
+                            vertexCorners[cornerStart[index[k]]++] = (u32)(f * 3 + k);
+                    }
+                }
+                if (pass == 0) {
+                    for (size_t v = 0; v < numVerts; v++)
+                        cornerStart[v + 1] += cornerStart[v];
+                    vertexCorners.resize(cornerStart[numVerts]);
+                }
+                else {
+                    // filling advanced every start to the next one
+                    for (size_t v = numVerts; v > 0; v--)
+                        cornerStart[v] = cornerStart[v - 1];
+                    cornerStart[0] = 0;
+                }
+            }
+
+            if (!obj->getSmoothingGroups().empty() && obj->getSmoothingGroups().size() == numFaces) {
+                CalculateGroupNormals(obj, corners, cornerStart, vertexCorners, threadCount);
+                return;
+            }
+
+            vector<Normal>& normals = obj->getNormals();
+            normals.assign(numVerts, Normal());
+            obj->getNormalIndices().clear();
+            ForRanges(numVerts, threadCount, [&normals, &corners, &cornerStart, &vertexCorners](size_t first, size_t last) {
+                for (size_t v = first; v < last; v++) {
+                    float sum[3] = { 0.0f, 0.0f, 0.0f };
+                    for (u32 c = cornerStart[v]; c < cornerStart[v + 1]; c++) {
+                        const Normal& corner = corners[vertexCorners[c]];
+                        sum[0] += corner.nx;
+                        sum[1] += corner.ny;
+                        sum[2] += corner.nz;
+                    }
+                    normals[v] = Average(sum, cornerStart[v + 1] - cornerStart[v]);
                 }
+            });
+        }
 
-                vector<float> sum = { 0.0, 0.0, 0.0 };
-                vector<float> zero = sum;
-                int shared = 0;
-                for (size_t v = 0; v < obj->getNumOfVertices(); v++) {
-                    for (size_t f = 0; f < obj->getNumOfTriangles(); f++) {
-                        if (obj->getTriangle(f)->index[0] == v ||
-                            obj->getTriangle(f)->index[1] == v ||
-                            obj->getTriangle(f)->index[2] == v) {
-                            sum = AddPoints(sum, &pTempNormals[f]);
+        // A corner only averages the corners around its vertex whose faces
+        // share a smoothing group with its own; faces in no group stay flat.
+        // The corners of a vertex that end up with the same normal share it,
+        // so vertices are split only where the groups make the shading differ.
+        static inline void CalculateGroupNormals(Object* obj, const vector<Normal>& corners,
+            const vector<u32>& cornerStart, const vector<u32>& vertexCorners, unsigned int threadCount) {
+            const vector<Triangle>& triangles = obj->getTriangles();
+            const vector<u32>& groups = obj->getSmoothingGroups();
+            size_t numVerts = cornerStart.size() - 1;
+
+            // the normal of every corner, and the first corner of the same
+            // vertex with a bit for bit identical one
+            vector<Normal> cornerNormals(corners.size());
+            vector<u32> sameAs(corners.size());
+            ForRanges(numVerts, threadCount, [&](size_t first, size_t last) {
+                // normals of the group masks seen at the current vertex
+                vector<pair<u32, u32> > masks;
+                for (size_t v = first; v < last; v++) {
+                    masks.clear();
+                    for (u32 c = cornerStart[v]; c < cornerStart[v + 1]; c++) {
+                        u32 corner = vertexCorners[c];
+                        u32 mask = groups[corner / 3];
+                        sameAs[corner] = corner;
+                        size_t m = 0;
+                        while (mask != 0 && m < masks.size() && masks[m].first != mask)
+                            m++;
+                        if (mask != 0 && m < masks.size()) {
+                            sameAs[corner] = sameAs[masks[m].second];
+                            cornerNormals[corner] = cornerNormals[masks[m].second];
+                            continue;
+                        }
+
+                        float sum[3] = { 0.0f, 0.0f, 0.0f };
+                        u32 shared = 0;
+                        for (u32 d = cornerStart[v]; d < cornerStart[v + 1]; d++) {
+                            u32 other = vertexCorners[d];
+                            if (other != corner && (mask & groups[other / 3]) == 0)
+                                continue;
+                            sum[0] += corners[other].nx;
+                            sum[1] += corners[other].ny;
+                            sum[2] += corners[other].nz;
                             shared++;
                         }
+                        Normal normal = Average(sum, shared);
+                        cornerNormals[corner] = normal;
+                        if (mask != 0)
+                            masks.push_back(make_pair(mask, corner));
+                        for (u32 d = cornerStart[v]; d < c; d++) {
+                            u32 other = vertexCorners[d];
+                            if (sameAs[other] == other && memcmp(&cornerNormals[other], &normal, sizeof(Normal)) == 0) {
+                                sameAs[corner] = other;
+                                break;
+                            }
+                        }
+                    }
+                }
+            });
+
+            // number the distinct normals vertex by vertex
+            vector<Normal>& normals = obj->getNormals();
+            vector<u32>& normalIndices = obj->getNormalIndices();
+            normals.clear();
+            normalIndices.assign(corners.size(), 0);
+            for (size_t v = 0; v < numVerts; v++) {
+                for (u32 c = cornerStart[v]; c < cornerStart[v + 1]; c++) {
+                    u32 corner = vertexCorners[c];
+                    if (sameAs[corner] != corner) {
+                        normalIndices[corner] = normalIndices[sameAs[corner]];
+                        continue;
                     }
-                    Normal* newNrm = DivideVectorByScaler(sum, float(-shared));
-                    Normalize(newNrm);
-                    obj->addNormal(newNrm);
-                    sum = zero;
-                    shared = 0;
+                    normalIndices[corner] = (u32)normals.size();
+                    normals.push_back(cornerNormals[corner]);
+                }
+            }
+            // a face that uses a vertex twice has one corner for it above
+            for (size_t f = 0; f < triangles.size(); f++) {
+                const u16* index = triangles[f].index;
+                for (int k = 1; k < 3; k++) {
+                    if (index[k] == index[0])
+                        normalIndices[f * 3 + k] = normalIndices[f * 3];
+                    else if (k == 2 && index[2] == index[1])
+                        normalIndices[f * 3 + 2] = normalIndices[f * 3 + 1];
                 }
             }
         }
+
+    public:
+        // threadCount = 0 uses one worker per hardware thread
+        static inline void CalculateNormals(ModelData& data, NormalWeighting weighting = WeightByArea, unsigned int threadCount = 0) {
+            if (threadCount == 0)
+                threadCount = ThreadPool::hardwareThreads();
+            for (size_t i = 0; i < data.getNumOfObjects(); i++)
+                CalculateNormals(data.getObject(i), weighting, threadCount);
+        }
     };
 
+    // Reads a .3ds file through a memory mapping, descending only into the
+    // chunks that lead to meshes and materials
     class Model3DS {
     private:
-        Chunk main;
+        // Number of elements of elementSize bytes a list chunk holds: the u16
+        // count it starts with, clamped to what its payload really contains
+        static inline size_t parse_count(const ChunkView& chunk, size_t elementSize) {
+            if (chunk.size < 2)
+                return 0;
+            u16 count;
+            memcpy(&count, chunk.data, 2);
+            size_t fits = (chunk.size - 2) / elementSize;
+            return fits < count ? fits : count;
+        }
+        inline void parse_OBJECTINFO(const ChunkView& chunk) {
+            ChunkIterator children(chunk);
+            ChunkView child;
+            while (children.next(child)) {
+                switch (child.id) {
+                case OBJECT:		parse_OBJECT(child); break;
+                case MATERIAL:		parse_MATERIAL(child); break;
+                }
+            }
+        }
+        inline void parse_OBJECT(const ChunkView& chunk) {
+            data.addObject(new Object());
+            // the name of the object comes first
+            ChunkIterator children(chunk, StringSize(chunk));
+            ChunkView child;
+            while (children.next(child)) {
+                if (child.id == OBJECT_MESH)
+                    parse_OBJECT_MESH(child);
+            }
+        }
+        inline void parse_OBJECT_MESH(const ChunkView& chunk) {
+            ChunkIterator children(chunk);
+            ChunkView child;
+            while (children.next(child)) {
+                switch (child.id) {
+                case OBJECT_VERTICES:	parse_OBJECT_VERTICES(child); break;
+                case OBJECT_FACES:	parse_OBJECT_FACES(child); break;
+                case OBJECT_UV:		parse_OBJECT_UV(child); break;
+                }
+            }
+        }
+        inline void parse_OBJECT_FACES(const ChunkView& chunk) {
+            Object* obj = data.getObject(data.getNumOfObjects() - 1);
+            size_t numFaces = parse_count(chunk, 8);
+            vector<Triangle>& triangles = obj->getTriangles();
+            triangles.resize(numFaces);
+            // three indices and a visibility flag (not needed) per face
+            const char* face = chunk.data + 2;
+            for (size_t i = 0; i < numFaces; i++, face += 8)
+                memcpy(triangles[i].index, face, 6);
+
+            // the face list is followed by chunks about the faces
+            ChunkIterator children(chunk, 2 + numFaces * 8);
+            ChunkView child;
+            while (children.next(child)) {
+                if (child.id == OBJECT_SMOOTH_GRP)
+                    parse_OBJECT_SMOOTH_GRP(child, obj);
+            }
+        }
+        // one u32 mask per face, a face in no group is flat
+        inline void parse_OBJECT_SMOOTH_GRP(const ChunkView& chunk, Object* obj) {
+            size_t numFaces = obj->getNumOfTriangles();
+            vector<u32>& groups = obj->getSmoothingGroups();
+            groups.assign(numFaces, 0);
+            size_t numGroups = chunk.size / 4 < numFaces ? chunk.size / 4 : numFaces;
+            if (numGroups > 0)
+                memcpy(&groups[0], chunk.data, numGroups * 4);
+        }
+        inline void parse_OBJECT_VERTICES(const ChunkView& chunk) {
+            Object* obj = data.getObject(data.getNumOfObjects() - 1);
+            size_t numVerts = parse_count(chunk, sizeof(Vertex));
+            vector<Vertex>& vertices = obj->getVertices();
+            vertices.resize(numVerts);
+            if (numVerts > 0)
+                memcpy(&vertices[0], chunk.data + 2, numVerts * sizeof(Vertex));
+            if (data.swapUpAxis) {
+                // Need to swap the Y & Z positions, and negate the new z
+                for (size_t i = 0; i < numVerts; i++) {
+                    float y = vertices[i].y;
+                    vertices[i].y = vertices[i].z;
+                    vertices[i].z = -y;
+                }
+            }
+        }
+        inline void parse_OBJECT_UV(const ChunkView& chunk) {
+            Object* obj = data.getObject(data.getNumOfObjects() - 1);
+            size_t numTexCords = parse_count(chunk, sizeof(TextureCoord));
+            vector<TextureCoord>& texuvs = obj->getTextureCoords();
+            texuvs.resize(numTexCords);
+            if (numTexCords > 0)
+                memcpy(&texuvs[0], chunk.data + 2, numTexCords * sizeof(TextureCoord));
+        }
+        inline void parse_MATERIAL(const ChunkView& chunk) {
+            Material* mat = new Material();
+            data.addMaterial(mat);
+            ChunkIterator children(chunk);
+            ChunkView child;
+            while (children.next(child)) {
+                switch (child.id) {
+                case MATNAME:		mat->setName(ParseString(child)); break;
+                case MATMAP:		parse_MATMAP(child, mat); break;
+                }
+            }
+        }
+        inline void parse_MATMAP(const ChunkView& chunk, Material* mat) {
+            ChunkIterator children(chunk);
+            ChunkView child;
+            while (children.next(child)) {
+                if (child.id == MATMAPFILE)
+                    mat->setFileName(ParseString(child));
+            }
+        }
     public:
         ModelData data;
-        inline Model3DS(string filename, bool swapUpAxis = false) {
-            ifstream ifs(filename, ios::in | ios::binary);
+        inline Model3DS(string filename, bool swapUpAxis = false, NormalWeighting weighting = WeightByArea, unsigned int threadCount = 0) {
             data.swapUpAxis = swapUpAxis;
-            main.read(ifs);
-            main.readChildren(ifs, main.getLength() - 6, data);
-            //cout << main.to_string() << endl;
-            ifs.close();
+            MappedFile file(filename);
+            ChunkIterator top(file.data(), file.end());
+            ChunkView main;
+            if (top.next(main) && main.id == PRIMARY) {
+                // keyframes and everything else at this level are skipped
+                ChunkIterator children(main);
+                ChunkView child;
+                while (children.next(child)) {
+                    if (child.id == OBJECTINFO)
+                        parse_OBJECTINFO(child);
+                }
+            }
 
-            NormalMath::CalculateNormals(data);
+            NormalMath::CalculateNormals(data, weighting, threadCount);
         }
     };
 };
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <atomic>
+#include <future>
+#include <cfloat>
+#include <algorithm>
+
+// One node of a Bvh, 32 bytes
+struct BvhNode {
+    glm::vec3 boundsMin;
+    // leaf: first entry in Bvh::primitives; interior: the left child, the right one follows it
+    unsigned int first;
+    glm::vec3 boundsMax;
+    // primitives in a leaf, 0 for interior nodes
+    unsigned int count;
+
+    bool isLeaf() const {
+        return count != 0;
+    }
+};
+
+// Bounding volume hierarchy over anything with a bounding box (triangles,
+// meshes), stored as one flat array of nodes with the root first. Built top
+// down with the surface area heuristic evaluated over Bins buckets per axis;
+// below the first few levels the subtrees are built in parallel on a
+// ThreadPool, each child pair taking the next two nodes of the array.
+class Bvh {
+public:
+    static const int Bins = 16;
+    // leaves never hold more primitives than this
+    static const unsigned int MaxLeafSize = 8;
+    // subtrees smaller than this are not worth a task of their own
+    static const unsigned int ParallelThreshold = 4096;
+    // below this depth nodes are split at the median instead, which bounds
+    // the depth (and the traversal stacks) for any input
+    static const unsigned int MaxSahDepth = 48;
+    static const unsigned int StackSize = MaxSahDepth + 40;
+
+    std::vector<BvhNode> nodes;
+    // primitive ids, ordered so every leaf references a contiguous range
+    std::vector<unsigned int> primitives;
+
+    // boxMin[i], boxMax[i] bound primitive i. threadCount = 0 uses one
+    // worker per hardware thread.
+    void build(const std::vector<glm::vec3>& boxMin, const std::vector<glm::vec3>& boxMax, unsigned int threadCount = 0) {
+        size_t count = boxMin.size();
+        nodes.clear();
+        primitives.resize(count);
+        if (count == 0)
+            return;
+
+        centroids.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            primitives[i] = (unsigned int)i;
+            centroids[i] = (boxMin[i] + boxMax[i]) * 0.5f;
+        }
+        this->boxMin = &boxMin;
+        this->boxMax = &boxMax;
+
+        // a binary tree with at most one primitive per leaf has 2n - 1 nodes
+        nodes.resize(2 * count - 1);
+        nodeCount = 1;
+
+        if (threadCount == 0)
+            threadCount = ThreadPool::hardwareThreads();
+        Task root = { 0, 0, (unsigned int)count, 0 };
+        if (threadCount == 1 || count < ParallelThreshold) {
+            subdivide(root);
+        }
+        else {
+            // split the top of the tree here until there is enough work for
+            // every worker, then build the subtrees below it concurrently
+            std::vector<Task> pending(1, root), next;
+            while (!pending.empty() && pending.size() < threadCount * 4) {
+                next.clear();
+                for (size_t i = 0; i < pending.size(); i++)
+                    subdivideOnce(pending[i], next);
+                pending.swap(next);
+            }
+
+            ThreadPool pool(threadCount);
+            std::vector<std::future<void> > running;
+            for (size_t i = 0; i < pending.size(); i++) {
+                Task task = pending[i];
+                running.push_back(pool.enqueue([this, task]() { subdivide(task); }));
+            }
+            for (size_t i = 0; i < running.size(); i++)
+                running[i].get();
+        }
+
+        nodes.resize(nodeCount);
+        nodes.shrink_to_fit();
+        std::vector<glm::vec3>().swap(centroids);
+        this->boxMin = NULL;
+        this->boxMax = NULL;
+    }
+
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    size_t memoryBytes() const {
+        return nodes.capacity() * sizeof(BvhNode) + primitives.capacity() * sizeof(unsigned int);
+    }
+
+    // Call visit(primitive) for every primitive in the leaves whose box
+    // intersects the frustum
+    template <class F>
+    void cull(const Frustum& frustum, F visit) const {
+        if (nodes.empty())
+            return;
+        unsigned int stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BvhNode& node = nodes[stack[--top]];
+            if (!frustum.intersects(node.boundsMin, node.boundsMax))
+                continue;
+            if (node.isLeaf()) {
+                for (unsigned int i = 0; i < node.count; i++)
+                    visit(primitives[node.first + i]);
+                continue;
+            }
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+        }
+    }
+
+    // Walk the leaves the ray origin + t * direction (0 <= t <= tMax) passes
+    // through, nearest child first. hit(primitive, tMax) tests a primitive and
+    // lowers tMax when it is hit closer; returns true if anything was hit.
+    template <class F>
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float& tMax, F hit) const {
+        if (nodes.empty())
+            return false;
+        glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        bool found = false;
+        unsigned int stack[StackSize];
+        int top = 0;
+        if (slab(nodes[0], origin, inverse, tMax) < FLT_MAX)
+            stack[top++] = 0;
+        while (top > 0) {
+            const BvhNode& node = nodes[stack[--top]];
+            if (node.isLeaf()) {
+                for (unsigned int i = 0; i < node.count; i++)
+                    if (hit(primitives[node.first + i], tMax))
+                        found = true;
+                continue;
+            }
+            float tLeft = slab(nodes[node.first], origin, inverse, tMax);
+            float tRight = slab(nodes[node.first + 1], origin, inverse, tMax);
+            // push the farther child first so the nearer one is visited next
+            if (tLeft > tRight) {
+                std::swap(tLeft, tRight);
+                if (tRight < FLT_MAX)
+                    stack[top++] = node.first;
+                if (tLeft < FLT_MAX)
+                    stack[top++] = node.first + 1;
+            }
+            else {
+                if (tRight < FLT_MAX)
+                    stack[top++] = node.first + 1;
+                if (tLeft < FLT_MAX)
+                    stack[top++] = node.first;
+            }
+        }
+        return found;
+    }
+
+private:
+    struct Task {
+        unsigned int node;
+        unsigned int first;
+        unsigned int count;
+        unsigned int depth;
+    };
+
+    struct Bin {
+        glm::vec3 boundsMin, boundsMax;
+        unsigned int count;
+    };
+
+    const std::vector<glm::vec3>* boxMin = NULL;
+    const std::vector<glm::vec3>* boxMax = NULL;
+    std::vector<glm::vec3> centroids;
+    std::atomic<unsigned int> nodeCount;
+
+    // distance along the ray to the box of node, FLT_MAX if it is missed
+    static float slab(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverse, float tMax) {
+        float tNear = 0.0f, tFar = tMax;
+        for (int k = 0; k < 3; k++) {
+            float t0 = (node.boundsMin[k] - origin[k]) * inverse[k];
+            float t1 = (node.boundsMax[k] - origin[k]) * inverse[k];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            // NaN (ray in the plane of a face) must not reject the box
+            tNear = t0 > tNear ? t0 : tNear;
+            tFar = t1 < tFar ? t1 : tFar;
+        }
+        return tNear <= tFar ? tNear : FLT_MAX;
+    }
+
+    static float area(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+        glm::vec3 d = boxMax - boxMin;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    // Build the whole subtree of task
+    void subdivide(const Task& root) {
+        std::vector<Task> stack(1, root);
+        while (!stack.empty()) {
+            Task task = stack.back();
+            stack.pop_back();
+            subdivideOnce(task, stack);
+        }
+    }
+
+    // Bound the node of task and either make it a leaf or split it, adding
+    // its two children to children
+    void subdivideOnce(const Task& task, std::vector<Task>& children) {
+        BvhNode& node = nodes[task.node];
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX), centreMin(FLT_MAX), centreMax(-FLT_MAX);
+        for (unsigned int i = task.first; i < task.first + task.count; i++) {
+            unsigned int p = primitives[i];
+            lo = (glm::min)(lo, (*boxMin)[p]);
+            hi = (glm::max)(hi, (*boxMax)[p]);
+            centreMin = (glm::min)(centreMin, centroids[p]);
+            centreMax = (glm::max)(centreMax, centroids[p]);
+        }
+        node.boundsMin = lo;
+        node.boundsMax = hi;
+        node.first = task.first;
+        node.count = task.count;
+        if (task.count <= 2 && task.count <= MaxLeafSize)
+            return;
+        if (task.depth >= MaxSahDepth) {
+            splitMedian(task, centreMax - centreMin, children);
+            return;
+        }
+
+        // best split over the bins of every axis
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = FLT_MAX;
+        Bin bins[Bins];
+        float rightArea[Bins];
+        unsigned int rightCount[Bins];
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = centreMax[axis] - centreMin[axis];
+            if (!(extent > 0.0f))
+                continue;
+            float scale = Bins / extent;
+            for (int b = 0; b < Bins; b++) {
+                bins[b].boundsMin = glm::vec3(FLT_MAX);
+                bins[b].boundsMax = glm::vec3(-FLT_MAX);
+                bins[b].count = 0;
+            }
+            for (unsigned int i = task.first; i < task.first + task.count; i++) {
+                unsigned int p = primitives[i];
+                Bin& bin = bins[binOf(centroids[p][axis], centreMin[axis], scale)];
+                bin.boundsMin = (glm::min)(bin.boundsMin, (*boxMin)[p]);
+                bin.boundsMax = (glm::max)(bin.boundsMax, (*boxMax)[p]);
+                bin.count++;
+            }
+            // sweep from the right, then from the left evaluating every plane
+            glm::vec3 rMin(FLT_MAX), rMax(-FLT_MAX);
+            unsigned int rCount = 0;
+            for (int b = Bins - 1; b > 0; b--) {
+                rMin = (glm::min)(rMin, bins[b].boundsMin);
+                rMax = (glm::max)(rMax, bins[b].boundsMax);
+                rCount += bins[b].count;
+                rightArea[b] = rCount ? area(rMin, rMax) : 0.0f;
+                rightCount[b] = rCount;
+            }
+            glm::vec3 lMin(FLT_MAX), lMax(-FLT_MAX);
+            unsigned int lCount = 0;
+            for (int b = 0; b + 1 < Bins; b++) {
+                lMin = (glm::min)(lMin, bins[b].boundsMin);
+                lMax = (glm::max)(lMax, bins[b].boundsMax);
+                lCount += bins[b].count;
+                if (lCount == 0 || rightCount[b + 1] == 0)
+                    continue;
+                float cost = area(lMin, lMax) * lCount + rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+
+        // a leaf costs one test per primitive, a split one box test plus the
+        // children weighted by the chance of hitting them
+        float nodeArea = area(lo, hi);
+        float leafCost = (float)task.count;
+        float splitCost = nodeArea > 0.0f ? 1.0f + bestCost / nodeArea : leafCost;
+        if (task.count <= MaxLeafSize && (bestAxis < 0 || splitCost >= leafCost))
+            return;
+
+        if (bestAxis < 0) {
+            // all centroids coincide, halve the range to bound the leaf size
+            split(task, task.first + task.count / 2, children);
+            return;
+        }
+        float scale = Bins / (centreMax[bestAxis] - centreMin[bestAxis]);
+        const std::vector<glm::vec3>& c = centroids;
+        float offset = centreMin[bestAxis];
+        unsigned int* middle = std::partition(&primitives[task.first], &primitives[task.first] + task.count,
+            [&c, bestAxis, offset, scale, bestSplit](unsigned int p) { return binOf(c[p][bestAxis], offset, scale) < bestSplit; });
+        split(task, (unsigned int)(middle - &primitives[0]), children);
+    }
+
+    // Halve the range of task along the longest axis of its centroids
+    void splitMedian(const Task& task, const glm::vec3& extent, std::vector<Task>& children) {
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        const std::vector<glm::vec3>& c = centroids;
+        unsigned int* first = &primitives[task.first];
+        std::nth_element(first, first + task.count / 2, first + task.count,
+            [&c, axis](unsigned int a, unsigned int b) { return c[a][axis] < c[b][axis]; });
+        split(task, task.first + task.count / 2, children);
+    }
+
+    // Turn the node of task into an interior node whose children share its
+    // range at middle
+    void split(const Task& task, unsigned int middle, std::vector<Task>& children) {
+        unsigned int left = nodeCount.fetch_add(2);
+        BvhNode& node = nodes[task.node];
+        node.first = left;
+        node.count = 0;
+        Task l = { left, task.first, middle - task.first, task.depth + 1 };
+        Task r = { left + 1, middle, task.first + task.count - middle, task.depth + 1 };
+        children.push_back(l);
+        children.push_back(r);
+    }
+
+    static int binOf(float value, float offset, float scale) {
+        int b = (int)((value - offset) * scale);
+        return b < 0 ? 0 : (b >= Bins ? Bins - 1 : b);
+    }
+};
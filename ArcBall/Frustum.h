@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// The six planes of a clip matrix (Gribb & Hartmann), in the space the
+// matrix maps from: built from projection * view * model they can be tested
+// against bounds in model space. Plane normals point inwards and are not
+// normalized, the tests only need signs.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    Frustum() {
+    }
+
+    explicit Frustum(const glm::mat4& clip) {
+        // rows of the (column major) matrix
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++)
+            row[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+        planes[0] = row[3] + row[0];   // left
+        planes[1] = row[3] - row[0];   // right
+        planes[2] = row[3] + row[1];   // bottom
+        planes[3] = row[3] - row[1];   // top
+        planes[4] = row[3] + row[2];   // near
+        planes[5] = row[3] - row[2];   // far
+    }
+
+    // false only if the box is entirely outside one of the planes
+    bool intersects(const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+        for (int i = 0; i < 6; i++) {
+            const glm::vec4& p = planes[i];
+            // the corner furthest along the plane normal
+            glm::vec3 corner(p.x >= 0.0f ? boxMax.x : boxMin.x, p.y >= 0.0f ? boxMax.y : boxMin.y, p.z >= 0.0f ? boxMax.z : boxMin.z);
+            if (p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool intersects(const glm::vec3& centre, float radius) const {
+        for (int i = 0; i < 6; i++) {
+            const glm::vec4& p = planes[i];
+            float length = glm::length(glm::vec3(p.x, p.y, p.z));
+            if (p.x * centre.x + p.y * centre.y + p.z * centre.z + p.w < -radius * length)
+                return false;
+        }
+        return true;
+    }
+};
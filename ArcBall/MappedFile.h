@@ -0,0 +1,141 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+// keep windows.h from defining min/max macros, every header after this one
+// calls std::min/std::max and glm::min/glm::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file.
+// The loaders parse straight out of the mapping instead of copying through a stream.
+class MappedFile {
+public:
+    MappedFile() : mappedData(NULL), mappedSize(0) {
+#ifdef _WIN32
+        fileHandle = INVALID_HANDLE_VALUE;
+        mappingHandle = NULL;
+#else
+        fileDescriptor = -1;
+#endif
+    }
+
+    explicit MappedFile(const std::string& path) : MappedFile() {
+        open(path);
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(fileHandle, &size)) {
+            close();
+            return false;
+        }
+        mappedSize = (size_t)size.QuadPart;
+        // an empty file cannot be mapped, but it is still a valid (empty) file
+        if (mappedSize == 0)
+            return true;
+
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle == NULL) {
+            close();
+            return false;
+        }
+        mappedData = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (mappedData == NULL) {
+            close();
+            return false;
+        }
+#else
+        fileDescriptor = ::open(path.c_str(), O_RDONLY);
+        if (fileDescriptor < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fileDescriptor, &st) != 0) {
+            close();
+            return false;
+        }
+        mappedSize = (size_t)st.st_size;
+        if (mappedSize == 0)
+            return true;
+
+        void* data = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (data == MAP_FAILED) {
+            close();
+            return false;
+        }
+        madvise(data, mappedSize, MADV_SEQUENTIAL);
+        mappedData = (const char*)data;
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (mappedData)
+            UnmapViewOfFile(mappedData);
+        if (mappingHandle != NULL)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (mappedData)
+            munmap((void*)mappedData, mappedSize);
+        if (fileDescriptor >= 0)
+            ::close(fileDescriptor);
+        fileDescriptor = -1;
+#endif
+        mappedData = NULL;
+        mappedSize = 0;
+    }
+
+    bool isOpen() const {
+#ifdef _WIN32
+        return fileHandle != INVALID_HANDLE_VALUE;
+#else
+        return fileDescriptor >= 0;
+#endif
+    }
+
+    const char* data() const { return mappedData; }
+    const char* end() const { return mappedData + mappedSize; }
+    size_t size() const { return mappedSize; }
+
+private:
+    const char* mappedData;
+    size_t mappedSize;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+};
@@ -7,6 +7,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Shader.h"
+#include "StagingRing.h"
+#include "VertexFormat.h"
 
 #include <string>
 #include <fstream>
@@ -27,32 +29,285 @@ struct Texture {
     string path;
 };
 
+// One level of detail: a range of Mesh::indices over the mesh's vertices
+struct MeshLod {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // how far (in model units) the surface may be from the full detail one
+    float error;
+};
+
 class Mesh {
 public:
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
     unsigned int VAO;
+    // where the mesh starts in its buffers, non zero when they are shared (see MeshArena)
+    int baseVertex;
+    size_t indexOffset;
+    // layout of the vertices on the GPU and how vertex.glsl decodes positions
+    VertexFormat format;
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+    // levels of detail from finest to coarsest, their indices are stored one
+    // after the other in indices; empty if indices is the only level
+    vector<MeshLod> lods;
+    // bounding box and sphere of the vertices
+    glm::vec3 boundsMin, boundsMax;
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+
+    // takes the arrays by value so callers can std::move their buffers in.
+    // With uploadNow = false no GL call is made (the mesh can be built on any
+    // thread) and upload() has to be called on the GL thread before drawing.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool uploadNow = true)
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)),
+          VAO(0), baseVertex(0), indexOffset(0), format(VertexFloat), positionOffset(0.0f), positionScale(1.0f),
+          VBO(0), EBO(0), streamedBytes(0), uploaded(false) {
+        nameSamplers();
+        computeBounds();
+        if (uploadNow)
+            upload();
+    }
+
+    // Use a range of buffers shared with other meshes instead of creating
+    // its own; has to be called before the upload starts
+    void placeInBuffers(unsigned int vao, unsigned int vbo, unsigned int ebo, int firstVertex, size_t firstIndexByte) {
+        VAO = vao;
+        VBO = vbo;
+        EBO = ebo;
+        baseVertex = firstVertex;
+        indexOffset = firstIndexByte;
+    }
+
+    // Upload the vertices in the 16 byte PackedVertex layout, positions
+    // quantized inside [boxMin, boxMax] (the bounds of the mesh, or of all
+    // meshes sharing a MeshArena). Has to be called before the upload starts;
+    // vertices keeps the full precision data.
+    void compact(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+        format = VertexCompact;
+        positionOffset = boxMin;
+        positionScale = boxMax - boxMin;
+        packedVertices.resize(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            const Vertex& v = vertices[i];
+            PackedVertex& p = packedVertices[i];
+            for (int k = 0; k < 3; k++)
+                p.Position[k] = vertexpack::quantize(v.Position[k], positionOffset[k], positionScale[k]);
+            p.Position[3] = 0;
+            vertexpack::octEncode(v.Normal, p.Normal);
+            p.TexCoords[0] = vertexpack::toHalf(v.TexCoords.x);
+            p.TexCoords[1] = vertexpack::toHalf(v.TexCoords.y);
+        }
+    }
+
+    static size_t vertexStride(VertexFormat format) {
+        return format == VertexCompact ? sizeof(PackedVertex) : sizeof(Vertex);
+    }
+
+    size_t lodCount() const {
+        return lods.empty() ? 1 : lods.size();
+    }
+
+    MeshLod lod(size_t level) const {
+        if (!lods.empty())
+            return lods[level < lods.size() ? level : lods.size() - 1];
+        MeshLod all = { 0, (unsigned int)indices.size(), 0.0f };
+        return all;
+    }
+
+    // byte offset of a level in the element buffer
+    size_t lodOffset(const MeshLod& level) const {
+        return indexOffset + level.firstIndex * indexSize();
+    }
+
+    // Indices go to the GPU as 16 bit values whenever every vertex can be
+    // addressed with them (they are relative to baseVertex); indices itself
+    // always holds unsigned ints
+    GLenum indexType() const {
+        return vertices.size() <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    size_t indexSize() const {
+        return indexType() == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    }
+
+    // Upload the whole mesh at once (still through a bounded staging buffer)
+    void upload() {
+        StagingRing staging;
+        while (!uploadStep(staging, (size_t)-1))
+            ;
+    }
+
+    // Stream about maxBytes (at least one staging chunk) of the mesh into its
+    // buffers, so large uploads can be spread over several frames.
+    // Returns true once the mesh is complete.
+    bool uploadStep(StagingRing& staging, size_t maxBytes) {
+        if (uploaded)
+            return true;
+        if (VAO == 0)
+            setupMesh();
+
+        // narrow the indices once, before the first of them is sent
+        if (indexType() == GL_UNSIGNED_SHORT && shortIndices.size() != indices.size())
+            shortIndices.assign(indices.begin(), indices.end());
+
+        size_t stride = vertexStride(format);
+        const char* vertexData = format == VertexCompact ? (const char*)packedVertices.data() : (const char*)vertices.data();
+        const char* indexData = indexType() == GL_UNSIGNED_SHORT ? (const char*)shortIndices.data() : (const char*)indices.data();
+        size_t vertexBytes = vertices.size() * stride;
+        size_t totalBytes = vertexBytes + indices.size() * indexSize();
+        size_t vertexOffset = (size_t)baseVertex * stride;
+        size_t sent = 0;
+        while (streamedBytes < totalBytes && sent < maxBytes) {
+            size_t n;
+            if (streamedBytes < vertexBytes)
+                n = staging.upload(VBO, vertexOffset + streamedBytes, vertexData + streamedBytes, vertexBytes - streamedBytes);
+            else
+                n = staging.upload(EBO, indexOffset + streamedBytes - vertexBytes, indexData + (streamedBytes - vertexBytes), totalBytes - streamedBytes);
+            streamedBytes += n;
+            sent += n;
+        }
+        uploaded = streamedBytes == totalBytes;
+        // the packed copies only exist for the upload
+        if (uploaded) {
+            vector<PackedVertex>().swap(packedVertices);
+            vector<unsigned short>().swap(shortIndices);
+        }
+        return uploaded;
+    }
+
+    bool isUploaded() const {
+        return uploaded;
+    }
+
+    // Texture unit shader reads each texture from, -1 if it samples none of them.
+    // The sampler names are built once, in the constructor, and matched to
+    // the shader's units once per program.
+    const vector<int>& textureUnitsFor(const Shader &shader) const {
+        bindProgram(shader);
+        return textureUnits;
+    }
+
+    // Set the uniforms vertex.glsl decodes this mesh's vertex format with
+    void applyVertexDecode(const Shader &shader) const {
+        bindProgram(shader);
+        if (decodeLocations[0] >= 0)
+            glUniform3fv(decodeLocations[0], 1, &positionOffset[0]);
+        if (decodeLocations[1] >= 0)
+            glUniform3fv(decodeLocations[1], 1, &positionScale[0]);
+        if (decodeLocations[2] >= 0)
+            glUniform1i(decodeLocations[2], format == VertexCompact);
+    }
+
+    // true if both meshes are drawn with the same decode uniforms
+    bool sameVertexDecode(const Mesh& other) const {
+        return format == other.format && positionOffset == other.positionOffset && positionScale == other.positionScale;
+    }
+
+    // Draw on its own, binding everything; Model::Draw batches through a RenderQueue
+    void Draw(const Shader &shader, size_t level = 0) const {
+        if (!isUploaded())
+            return;
+
+        applyVertexDecode(shader);
+
+        // bind appropriate textures to the units the shader reads them from
+        textureUnitsFor(shader);
+        for (unsigned int i = 0; i < textures.size(); i++){
+            if (textureUnits[i] < 0)
+                continue;
+            glActiveTexture(GL_TEXTURE0 + textureUnits[i]); // active proper texture unit before binding
+            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        }
+
+        glBindVertexArray(VAO);
+        MeshLod range = lod(level);
+        glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)range.indexCount, indexType(), (void*)lodOffset(range), baseVertex);
+        glBindVertexArray(0);
 
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures){
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        glActiveTexture(GL_TEXTURE0);
+    }
 
-        setupMesh();
+    // set the vertex attribute pointers of the bound VAO for the bound GL_ARRAY_BUFFER
+    static void setupVertexLayout(VertexFormat format) {
+        if (format == VertexCompact) {
+            // positions in [0, 1] of the box, octahedral normals, half float texture coords;
+            // vertex.glsl decodes them when applyVertexDecode sets octahedralNormals
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Position));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+            return;
+        }
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+    }
+
+private:
+    unsigned int VBO, EBO;
+    // bytes of vertices followed by indices already in the buffers
+    size_t streamedBytes;
+    bool uploaded;
+    // sampler uniform of every texture, e.g. "texture_diffuse1"
+    vector<string> samplerNames;
+    // texture unit of every texture in samplerProgram, -1 if it samples none of them
+    mutable unsigned int samplerProgram = 0;
+    mutable vector<int> textureUnits;
+    // positionOffset, positionScale and octahedralNormals in samplerProgram
+    mutable GLint decodeLocations[3];
+    // vertices in the compact layout, until they are uploaded
+    vector<PackedVertex> packedVertices;
+    // indices as 16 bit values while they are uploaded
+    vector<unsigned short> shortIndices;
+
+    void bindProgram(const Shader &shader) const {
+        if (samplerProgram == shader.ID)
+            return;
+        textureUnits.resize(textures.size());
+        for (unsigned int i = 0; i < textures.size(); i++)
+            textureUnits[i] = shader.samplerUnit(samplerNames[i]);
+        decodeLocations[0] = shader.location("positionOffset");
+        decodeLocations[1] = shader.location("positionScale");
+        decodeLocations[2] = shader.location("octahedralNormals");
+        samplerProgram = shader.ID;
     }
 
-    void Draw(Shader shader){
-        // bind appropriate textures
+    void computeBounds() {
+        boundsMin = boundsMax = vertices.empty() ? glm::vec3(0.0f) : vertices[0].Position;
+        for (size_t i = 1; i < vertices.size(); i++) {
+            boundsMin = glm::min(boundsMin, vertices[i].Position);
+            boundsMax = glm::max(boundsMax, vertices[i].Position);
+        }
+        boundsCenter = (boundsMin + boundsMax) * 0.5f;
+        boundsRadius = 0.0f;
+        for (size_t i = 0; i < vertices.size(); i++) {
+            glm::vec3 d = vertices[i].Position - boundsCenter;
+            boundsRadius = glm::max(boundsRadius, glm::dot(d, d));
+        }
+        boundsRadius = sqrt(boundsRadius);
+    }
+
+    // retrieve texture number (the N in diffuse_textureN)
+    void nameSamplers() {
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr = 1;
         unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++){
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
+        samplerNames.resize(textures.size());
+        for (unsigned int i = 0; i < textures.size(); i++) {
             string number;
-            string name = textures[i].type;
+            const string& name = textures[i].type;
             if (name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if (name == "texture_specular")
@@ -61,50 +316,27 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to stream
             else if (name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            samplerNames[i] = name + number;
         }
-
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        glActiveTexture(GL_TEXTURE0);
     }
 
-private:
-    unsigned int VBO, EBO;
-
     void setupMesh(){
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
         glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        // only allocate the buffers here, uploadStep streams the data in.
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * vertexStride(format), NULL, GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * indexSize(), NULL, GL_STATIC_DRAW);
 
+        setupVertexLayout(format);
         glBindVertexArray(0);
     }
 };
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Mesh.h"
+
+#include <vector>
+
+// One VAO with a single vertex and index buffer shared by all meshes of a
+// model. Every mesh gets a base vertex and an index offset into them, so the
+// whole model draws without switching VAOs and meshes with the same material
+// can be merged into one glMultiDrawElementsBaseVertex.
+class MeshArena {
+public:
+    unsigned int VAO, VBO, EBO;
+    size_t vertexCount;
+    size_t indexBytes;
+
+    MeshArena() : VAO(0), VBO(0), EBO(0), vertexCount(0), indexBytes(0) {
+    }
+
+    bool isBuilt() const {
+        return VAO != 0;
+    }
+
+    // Allocate the buffers for meshes (which must not be uploaded yet and all
+    // have the same vertex format) and place each mesh in them; the data is
+    // streamed in by Mesh::uploadStep
+    void build(vector<Mesh>& meshes) {
+        VertexFormat format = meshes.empty() ? VertexFloat : meshes[0].format;
+        vertexCount = 0;
+        indexBytes = 0;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            vertexCount += meshes[i].vertices.size();
+            indexBytes = alignIndices(indexBytes, meshes[i]) + meshes[i].indices.size() * meshes[i].indexSize();
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * Mesh::vertexStride(format), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+        Mesh::setupVertexLayout(format);
+        glBindVertexArray(0);
+
+        size_t firstVertex = 0, firstIndexByte = 0;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            firstIndexByte = alignIndices(firstIndexByte, meshes[i]);
+            meshes[i].placeInBuffers(VAO, VBO, EBO, (int)firstVertex, firstIndexByte);
+            firstVertex += meshes[i].vertices.size();
+            firstIndexByte += meshes[i].indices.size() * meshes[i].indexSize();
+        }
+    }
+
+private:
+    // meshes with 16 and 32 bit indices share the index buffer, each mesh
+    // has to start at a multiple of its own index size
+    static size_t alignIndices(size_t offset, const Mesh& mesh) {
+        size_t size = mesh.indexSize();
+        return (offset + size - 1) / size * size;
+    }
+};
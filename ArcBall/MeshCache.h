@@ -0,0 +1,321 @@
+#pragma once
+
+#include "Mesh.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+// Binary cache of a Model's meshes, stored next to the source file as
+// "<source>.meshcache". The layout is made to be used straight out of a
+// memory mapping (native endianness, 16 byte aligned arrays):
+//
+//   Header
+//   MeshEntry[meshCount]
+//   TextureEntry[textureCount]   type/path pairs, meshes refer to ranges of them
+//   DependencyEntry[dependencyCount]  other files the meshes were built from
+//   char strings[stringSize]      source path, texture types and paths, dependency paths
+//   Vertex vertices[vertexCount]
+//   unsigned int indices[indexCount]
+//
+// A cache is only used if its version, Vertex layout, load options, source
+// path, source size and source mtime all match, and every dependency (the .mtl files of
+// an OBJ) still has the size and mtime it had when the cache was written;
+// otherwise the source is parsed again.
+class MeshCache {
+public:
+    static const unsigned int Version = 2;
+
+    struct Header {
+        char magic[8];
+        unsigned int version;
+        unsigned int vertexSize;
+        unsigned long long sourceSize;
+        long long sourceTime;
+        unsigned int sourcePathOffset;
+        unsigned int sourcePathLength;
+        unsigned int meshCount;
+        unsigned int textureCount;
+        unsigned int dependencyCount;
+        // how the source was turned into meshes, see write()
+        unsigned int options;
+        unsigned long long stringsOffset;
+        unsigned long long stringSize;
+        unsigned long long verticesOffset;
+        unsigned long long vertexCount;
+        unsigned long long indicesOffset;
+        unsigned long long indexCount;
+    };
+
+    struct MeshEntry {
+        unsigned long long firstVertex;
+        unsigned long long vertexCount;
+        unsigned long long firstIndex;
+        unsigned long long indexCount;
+        unsigned int firstTexture;
+        unsigned int textureCount;
+    };
+
+    struct TextureEntry {
+        unsigned int typeOffset;
+        unsigned int typeLength;
+        unsigned int pathOffset;
+        unsigned int pathLength;
+    };
+
+    // A missing file is stamped with size ~0 and time 0, so it has to stay missing
+    struct DependencyEntry {
+        unsigned int pathOffset;
+        unsigned int pathLength;
+        unsigned long long size;
+        long long time;
+    };
+
+    static std::string pathFor(const std::string& source) {
+        return source + ".meshcache";
+    }
+
+    // Size and modification time of a file
+    static bool stampOf(const std::string& path, unsigned long long& size, long long& time) {
+#ifdef _WIN32
+        struct _stat64 st;
+        if (_stat64(path.c_str(), &st) != 0)
+            return false;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return false;
+#endif
+        size = (unsigned long long)st.st_size;
+        time = (long long)st.st_mtime;
+        return true;
+    }
+
+    // Write the meshes loaded from source into its cache file. options are
+    // whatever settings the meshes depend on (e.g. the normal weighting of
+    // a 3DS file); open() only accepts a cache written with the same ones.
+    // The file is written under a temporary name and renamed into place,
+    // so a reader never sees a half written cache.
+    static bool write(const std::string& source, const std::vector<Mesh>& meshes,
+        const std::vector<std::string>& dependencies = std::vector<std::string>(), unsigned int options = 0) {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "ARCBMESH", 8);
+        header.version = Version;
+        header.vertexSize = sizeof(Vertex);
+        header.options = options;
+        if (!stampOf(source, header.sourceSize, header.sourceTime))
+            return false;
+
+        std::string strings;
+        header.sourcePathOffset = addString(strings, source);
+        header.sourcePathLength = (unsigned int)source.size();
+
+        std::vector<MeshEntry> entries;
+        std::vector<TextureEntry> textures;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const Mesh& mesh = meshes[i];
+            MeshEntry entry;
+            entry.firstVertex = header.vertexCount;
+            entry.vertexCount = mesh.vertices.size();
+            entry.firstIndex = header.indexCount;
+            entry.indexCount = mesh.indices.size();
+            entry.firstTexture = (unsigned int)textures.size();
+            entry.textureCount = (unsigned int)mesh.textures.size();
+            for (size_t t = 0; t < mesh.textures.size(); t++) {
+                TextureEntry texture;
+                texture.typeOffset = addString(strings, mesh.textures[t].type);
+                texture.typeLength = (unsigned int)mesh.textures[t].type.size();
+                texture.pathOffset = addString(strings, mesh.textures[t].path);
+                texture.pathLength = (unsigned int)mesh.textures[t].path.size();
+                textures.push_back(texture);
+            }
+            entries.push_back(entry);
+            header.vertexCount += entry.vertexCount;
+            header.indexCount += entry.indexCount;
+        }
+        std::vector<DependencyEntry> stamps;
+        for (size_t i = 0; i < dependencies.size(); i++) {
+            DependencyEntry stamp;
+            stampOrMissing(dependencies[i], stamp);
+            stamp.pathOffset = addString(strings, dependencies[i]);
+            stamp.pathLength = (unsigned int)dependencies[i].size();
+            stamps.push_back(stamp);
+        }
+        header.meshCount = (unsigned int)entries.size();
+        header.textureCount = (unsigned int)textures.size();
+        header.dependencyCount = (unsigned int)stamps.size();
+        header.stringSize = strings.size();
+
+        unsigned long long offset = sizeof(Header);
+        offset += entries.size() * sizeof(MeshEntry);
+        offset += textures.size() * sizeof(TextureEntry);
+        offset += stamps.size() * sizeof(DependencyEntry);
+        header.stringsOffset = offset;
+        offset = align(offset + strings.size());
+        header.verticesOffset = offset;
+        offset = align(offset + header.vertexCount * sizeof(Vertex));
+        header.indicesOffset = offset;
+
+        std::string target = pathFor(source);
+        std::string temporary = target + ".tmp";
+        std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+            return false;
+
+        out.write((const char*)&header, sizeof(header));
+        if (!entries.empty())
+            out.write((const char*)&entries[0], entries.size() * sizeof(MeshEntry));
+        if (!textures.empty())
+            out.write((const char*)&textures[0], textures.size() * sizeof(TextureEntry));
+        if (!stamps.empty())
+            out.write((const char*)&stamps[0], stamps.size() * sizeof(DependencyEntry));
+        out.write(strings.data(), strings.size());
+        pad(out, header.verticesOffset);
+        for (size_t i = 0; i < meshes.size(); i++)
+            if (!meshes[i].vertices.empty())
+                out.write((const char*)&meshes[i].vertices[0], meshes[i].vertices.size() * sizeof(Vertex));
+        pad(out, header.indicesOffset);
+        for (size_t i = 0; i < meshes.size(); i++)
+            if (!meshes[i].indices.empty())
+                out.write((const char*)&meshes[i].indices[0], meshes[i].indices.size() * sizeof(unsigned int));
+        out.close();
+
+        if (out.fail()) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        std::remove(target.c_str());
+        return std::rename(temporary.c_str(), target.c_str()) == 0;
+    }
+
+    // Map the cache of source, fails if it is missing or stale
+    bool open(const std::string& source, unsigned int options = 0) {
+        file.close();
+        header = NULL;
+
+        unsigned long long size;
+        long long time;
+        if (!stampOf(source, size, time))
+            return false;
+        if (!file.open(pathFor(source)) || file.size() < sizeof(Header))
+            return false;
+
+        const Header* h = (const Header*)file.data();
+        if (memcmp(h->magic, "ARCBMESH", 8) != 0 || h->version != Version || h->vertexSize != sizeof(Vertex)
+            || h->options != options
+            || h->sourceSize != size || h->sourceTime != time)
+            return fail();
+
+        unsigned long long tables = sizeof(Header) + h->meshCount * (unsigned long long)sizeof(MeshEntry)
+            + h->textureCount * (unsigned long long)sizeof(TextureEntry)
+            + h->dependencyCount * (unsigned long long)sizeof(DependencyEntry);
+        if (tables > h->stringsOffset || h->stringsOffset + h->stringSize > h->verticesOffset
+            || h->verticesOffset + h->vertexCount * sizeof(Vertex) > h->indicesOffset
+            || h->indicesOffset + h->indexCount * sizeof(unsigned int) > file.size())
+            return fail();
+
+        header = h;
+        if (h->sourcePathOffset + (unsigned long long)h->sourcePathLength > h->stringSize
+            || std::string(strings() + h->sourcePathOffset, h->sourcePathLength) != source)
+            return fail();
+        for (size_t i = 0; i < meshCount(); i++) {
+            const MeshEntry& m = mesh(i);
+            if (m.firstVertex + m.vertexCount > h->vertexCount || m.firstIndex + m.indexCount > h->indexCount
+                || m.firstTexture + (unsigned long long)m.textureCount > h->textureCount)
+                return fail();
+        }
+        for (size_t i = 0; i < h->textureCount; i++) {
+            const TextureEntry& t = textureEntries()[i];
+            if (t.typeOffset + (unsigned long long)t.typeLength > h->stringSize
+                || t.pathOffset + (unsigned long long)t.pathLength > h->stringSize)
+                return fail();
+        }
+        for (size_t i = 0; i < h->dependencyCount; i++) {
+            const DependencyEntry& d = dependencyEntries()[i];
+            if (d.pathOffset + (unsigned long long)d.pathLength > h->stringSize)
+                return fail();
+            DependencyEntry now;
+            stampOrMissing(std::string(strings() + d.pathOffset, d.pathLength), now);
+            if (now.size != d.size || now.time != d.time)
+                return fail();
+        }
+        return true;
+    }
+
+    size_t meshCount() const {
+        return header ? header->meshCount : 0;
+    }
+
+    const MeshEntry& mesh(size_t i) const {
+        return ((const MeshEntry*)(file.data() + sizeof(Header)))[i];
+    }
+
+    const Vertex* vertices(size_t i) const {
+        return (const Vertex*)(file.data() + header->verticesOffset) + mesh(i).firstVertex;
+    }
+
+    const unsigned int* indices(size_t i) const {
+        return (const unsigned int*)(file.data() + header->indicesOffset) + mesh(i).firstIndex;
+    }
+
+    std::string textureType(size_t i, size_t t) const {
+        const TextureEntry& entry = textureEntries()[mesh(i).firstTexture + t];
+        return std::string(strings() + entry.typeOffset, entry.typeLength);
+    }
+
+    std::string texturePath(size_t i, size_t t) const {
+        const TextureEntry& entry = textureEntries()[mesh(i).firstTexture + t];
+        return std::string(strings() + entry.pathOffset, entry.pathLength);
+    }
+
+private:
+    MappedFile file;
+    const Header* header = NULL;
+
+    bool fail() {
+        file.close();
+        header = NULL;
+        return false;
+    }
+
+    const TextureEntry* textureEntries() const {
+        return (const TextureEntry*)(file.data() + sizeof(Header) + header->meshCount * sizeof(MeshEntry));
+    }
+
+    const DependencyEntry* dependencyEntries() const {
+        return (const DependencyEntry*)(textureEntries() + header->textureCount);
+    }
+
+    const char* strings() const {
+        return file.data() + header->stringsOffset;
+    }
+
+    static void stampOrMissing(const std::string& path, DependencyEntry& stamp) {
+        if (!stampOf(path, stamp.size, stamp.time)) {
+            stamp.size = ~0ull;
+            stamp.time = 0;
+        }
+    }
+
+    static unsigned int addString(std::string& strings, const std::string& s) {
+        unsigned int offset = (unsigned int)strings.size();
+        strings += s;
+        return offset;
+    }
+
+    static unsigned long long align(unsigned long long offset) {
+        return (offset + 15) & ~15ull;
+    }
+
+    static void pad(std::ofstream& out, unsigned long long offset) {
+        static const char zeros[16] = { 0 };
+        unsigned long long at = (unsigned long long)out.tellp();
+        if (offset > at)
+            out.write(zeros, (std::streamsize)(offset - at));
+    }
+};
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+// Post-transform vertex cache efficiency of an index buffer, measured on a
+// simulated FIFO cache
+struct VertexCacheStats {
+    size_t triangles;
+    size_t vertices;
+    size_t misses;
+
+    VertexCacheStats() : triangles(0), vertices(0), misses(0) {
+    }
+
+    // average cache miss ratio: vertices transformed per triangle (0.5 is ideal for large grids, 3 the worst)
+    float acmr() const {
+        return triangles ? (float)misses / triangles : 0.0f;
+    }
+
+    // average transform to vertex ratio: vertices transformed per vertex (1 is ideal)
+    float atvr() const {
+        return vertices ? (float)misses / vertices : 0.0f;
+    }
+
+    VertexCacheStats& operator+=(const VertexCacheStats& other) {
+        triangles += other.triangles;
+        vertices += other.vertices;
+        misses += other.misses;
+        return *this;
+    }
+};
+
+// Reorders the triangles and vertices of an indexed triangle list for the GPU:
+//  - optimizeVertexCache: Forsyth's linear speed vertex cache optimisation on
+//    a simulated LRU cache, followed by sorting the clusters it had to restart
+//    on so outward facing ones are drawn first (less overdraw)
+//  - optimizeVertexFetch: vertices in the order the triangles first use them,
+//    unused vertices dropped
+// Scratch buffers are kept between calls.
+class MeshOptimizer {
+public:
+    // LRU size the triangle scores are tuned for
+    static const int CacheSize = 32;
+    // FIFO size analyzeVertexCache reports with, close to common hardware
+    static const unsigned int ReportCacheSize = 16;
+    // triangles a cluster needs before a restart may end it; keeps meshes of
+    // many small pieces (e.g. unwelded flat faces) from being scattered
+    static const size_t MinClusterSize = 128;
+
+    template <class V>
+    void optimizeVertexCache(const std::vector<V>& vertices, std::vector<unsigned int>& indices) {
+        size_t triangleCount = indices.size() / 3;
+        size_t vertexCount = vertices.size();
+        if (triangleCount == 0)
+            return;
+
+        buildAdjacency(indices, vertexCount);
+
+        vertexScore.resize(vertexCount);
+        cachePosition.assign(vertexCount, -1);
+        for (size_t v = 0; v < vertexCount; v++)
+            vertexScore[v] = score(-1, liveTriangles[v]);
+        triangleScore.resize(triangleCount);
+        emitted.assign(triangleCount, 0);
+        for (size_t t = 0; t < triangleCount; t++)
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+        ordered.clear();
+        clusterStart.clear();
+        cache.clear();
+        size_t cursor = 0;
+        int best = -1;
+        while (ordered.size() < triangleCount) {
+            if (best < 0) {
+                // nothing in the cache is connected to a live triangle: start a
+                // new cluster at the next triangle in input order
+                while (emitted[cursor])
+                    cursor++;
+                best = (int)cursor;
+                if (clusterStart.empty() || ordered.size() - clusterStart.back() >= MinClusterSize)
+                    clusterStart.push_back(ordered.size());
+            }
+            emit(indices, (size_t)best);
+            best = rescoreCache();
+        }
+
+        sortClusters(vertices, indices);
+
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                reordered[t * 3 + k] = indices[ordered[t] * 3 + k];
+        indices.swap(reordered);
+    }
+
+    template <class V>
+    void optimizeVertexFetch(std::vector<V>& vertices, std::vector<unsigned int>& indices) {
+        remap.assign(vertices.size(), (unsigned int)-1);
+        unsigned int next = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            unsigned int& target = remap[indices[i]];
+            if (target == (unsigned int)-1)
+                target = next++;
+            indices[i] = target;
+        }
+        std::vector<V> fetched(next);
+        for (size_t v = 0; v < vertices.size(); v++)
+            if (remap[v] != (unsigned int)-1)
+                fetched[remap[v]] = vertices[v];
+        vertices.swap(fetched);
+    }
+
+    static VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount,
+        unsigned int cacheSize = ReportCacheSize) {
+        VertexCacheStats stats;
+        stats.triangles = indices.size() / 3;
+        stats.vertices = vertexCount;
+        // a vertex is in the FIFO while fewer than cacheSize misses happened since it was added
+        std::vector<size_t> added(vertexCount, 0);
+        size_t time = cacheSize + 1;
+        for (size_t i = 0; i < indices.size(); i++) {
+            size_t& t = added[indices[i]];
+            if (time - t > cacheSize) {
+                t = time++;
+                stats.misses++;
+            }
+        }
+        return stats;
+    }
+
+private:
+    // triangles of every vertex, as one flat array
+    std::vector<unsigned int> adjacencyStart;
+    std::vector<unsigned int> liveTriangles;
+    std::vector<unsigned int> adjacency;
+
+    std::vector<float> vertexScore;
+    std::vector<int> cachePosition;
+    std::vector<float> triangleScore;
+    std::vector<unsigned char> emitted;
+
+    // LRU cache, most recent first, and the next state being built
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> nextCache;
+
+    // triangles in output order and where each cluster starts in it
+    std::vector<size_t> ordered;
+    std::vector<size_t> clusterStart;
+    std::vector<std::pair<float, size_t> > clusterOrder;
+    std::vector<glm::vec3> centroids;
+    std::vector<glm::vec3> normals;
+    std::vector<size_t> clustered;
+
+    std::vector<unsigned int> reordered;
+    std::vector<unsigned int> remap;
+
+    static float score(int position, unsigned int live) {
+        if (live == 0)
+            return -1.0f;
+        float s = 0.0f;
+        if (position >= 0) {
+            // the last triangle's vertices get a fixed score so it is not simply repeated
+            if (position < 3)
+                s = 0.75f;
+            else
+                s = std::pow(1.0f - (float)(position - 3) / (CacheSize - 3), 1.5f);
+        }
+        // favour vertices with few triangles left, to finish them off
+        return s + 2.0f / std::sqrt((float)live);
+    }
+
+    void buildAdjacency(const std::vector<unsigned int>& indices, size_t vertexCount) {
+        liveTriangles.assign(vertexCount, 0);
+        for (size_t i = 0; i < indices.size() / 3 * 3; i++)
+            liveTriangles[indices[i]]++;
+        adjacencyStart.resize(vertexCount + 1);
+        adjacencyStart[0] = 0;
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyStart[v + 1] = adjacencyStart[v] + liveTriangles[v];
+        adjacency.resize(adjacencyStart[vertexCount]);
+        std::fill(liveTriangles.begin(), liveTriangles.end(), 0);
+        for (size_t i = 0; i < indices.size() / 3 * 3; i++) {
+            unsigned int v = indices[i];
+            adjacency[adjacencyStart[v] + liveTriangles[v]++] = (unsigned int)(i / 3);
+        }
+        reordered.resize(indices.size() / 3 * 3);
+    }
+
+    void emit(const std::vector<unsigned int>& indices, size_t triangle) {
+        emitted[triangle] = 1;
+        ordered.push_back(triangle);
+
+        nextCache.clear();
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = indices[triangle * 3 + k];
+            // drop the triangle from the live list of its vertices
+            unsigned int* first = &adjacency[adjacencyStart[v]];
+            unsigned int* last = first + liveTriangles[v];
+            *std::find(first, last, (unsigned int)triangle) = *(last - 1);
+            liveTriangles[v]--;
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+                nextCache.push_back(v);
+        }
+        for (size_t i = 0; i < cache.size(); i++)
+            if (std::find(nextCache.begin(), nextCache.end(), cache[i]) == nextCache.end())
+                nextCache.push_back(cache[i]);
+
+        // vertices that fell out of the cache lose their position score
+        for (size_t i = CacheSize; i < nextCache.size(); i++) {
+            unsigned int v = nextCache[i];
+            cachePosition[v] = -1;
+            updateVertexScore(v);
+        }
+        if (nextCache.size() > (size_t)CacheSize)
+            nextCache.resize(CacheSize);
+        cache.swap(nextCache);
+    }
+
+    // Update the scores of the cached vertices and their triangles, and
+    // return the best live triangle among them (-1 if there is none)
+    int rescoreCache() {
+        for (size_t i = 0; i < cache.size(); i++) {
+            cachePosition[cache[i]] = (int)i;
+            updateVertexScore(cache[i]);
+        }
+        int best = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cache.size(); i++) {
+            unsigned int v = cache[i];
+            for (unsigned int j = 0; j < liveTriangles[v]; j++) {
+                unsigned int t = adjacency[adjacencyStart[v] + j];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = (int)t;
+                }
+            }
+        }
+        return best;
+    }
+
+    void updateVertexScore(unsigned int v) {
+        float s = score(cachePosition[v], liveTriangles[v]);
+        float delta = s - vertexScore[v];
+        if (delta == 0.0f)
+            return;
+        vertexScore[v] = s;
+        for (unsigned int j = 0; j < liveTriangles[v]; j++)
+            triangleScore[adjacency[adjacencyStart[v] + j]] += delta;
+    }
+
+    // Draw the clusters facing away from the centre of the mesh first, they
+    // are the likeliest to occlude the others. Each cluster keeps its cache
+    // friendly order.
+    template <class V>
+    void sortClusters(const std::vector<V>& vertices, const std::vector<unsigned int>& indices) {
+        if (clusterStart.size() < 2)
+            return;
+
+        glm::vec3 centre(0.0f);
+        float area = 0.0f;
+        clusterOrder.clear();
+        clusterStart.push_back(ordered.size());
+        centroids.resize(clusterStart.size() - 1);
+        normals.resize(clusterStart.size() - 1);
+        for (size_t c = 0; c + 1 < clusterStart.size(); c++) {
+            glm::vec3 centroid(0.0f), normal(0.0f);
+            float clusterArea = 0.0f;
+            for (size_t i = clusterStart[c]; i < clusterStart[c + 1]; i++) {
+                size_t t = ordered[i];
+                const glm::vec3& a = vertices[indices[t * 3]].Position;
+                const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 n = glm::cross(b - a, d - a);
+                float w = glm::length(n);
+                centroid += (a + b + d) * (w / 3.0f);
+                normal += n;
+                clusterArea += w;
+            }
+            centre += centroid;
+            area += clusterArea;
+            centroids[c] = clusterArea > 0.0f ? centroid / clusterArea : centroid;
+            normals[c] = normal;
+        }
+        if (area > 0.0f)
+            centre /= area;
+
+        for (size_t c = 0; c < centroids.size(); c++) {
+            float length = glm::length(normals[c]);
+            float key = length > 0.0f ? glm::dot(centroids[c] - centre, normals[c] / length) : 0.0f;
+            clusterOrder.push_back(std::make_pair(-key, c));
+        }
+        std::stable_sort(clusterOrder.begin(), clusterOrder.end(),
+            [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first < b.first; });
+
+        clustered.clear();
+        for (size_t i = 0; i < clusterOrder.size(); i++) {
+            size_t c = clusterOrder[i].second;
+            clustered.insert(clustered.end(), ordered.begin() + clusterStart[c], ordered.begin() + clusterStart[c + 1]);
+        }
+        ordered.swap(clustered);
+    }
+};
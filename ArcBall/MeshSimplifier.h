@@ -0,0 +1,353 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+// Quadric error metric simplification (Garland & Heckbert) restricted to the
+// vertices a mesh already has, so every level of detail is just another index
+// buffer over the same vertex buffer. Vertices are welded by position first;
+// an edge collapse moves one welded position onto a neighbouring one and the
+// attributes of the surviving corners are taken from the closest matching
+// vertex at that position, so seams keep their texture coordinates.
+//
+//     simplifier.begin(vertices, indices);
+//     float error = simplifier.collapseTo(indices.size() / 6);
+//     simplifier.emit(vertices, lodIndices);
+//
+// collapseTo can be called again with fewer triangles for the next level.
+class MeshSimplifier {
+public:
+    // boundary edges are kept in place by planes weighted this much more than faces
+    static const int BoundaryWeight = 10;
+
+    template <class V>
+    void begin(const std::vector<V>& vertices, const std::vector<unsigned int>& indices) {
+        weld(vertices);
+
+        triangles.clear();
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            unsigned int a = group[indices[i]], b = group[indices[i + 1]], c = group[indices[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            triangles.push_back(Triangle());
+            Triangle& t = triangles.back();
+            t.corner[0] = a;
+            t.corner[1] = b;
+            t.corner[2] = c;
+            for (int k = 0; k < 3; k++)
+                t.vertex[k] = indices[i + k];
+        }
+        liveTriangles = triangles.size();
+        maxError = 0.0f;
+
+        size_t groups = positions.size();
+        quadrics.assign(groups, Quadric());
+        collapsed.resize(groups);
+        for (size_t g = 0; g < groups; g++)
+            collapsed[g] = (unsigned int)g;
+        version.assign(groups, 0);
+        around.assign(groups, std::vector<unsigned int>());
+        for (size_t t = 0; t < triangles.size(); t++)
+            for (int k = 0; k < 3; k++)
+                around[triangles[t].corner[k]].push_back((unsigned int)t);
+
+        addQuadrics();
+
+        heap = std::priority_queue<Collapse>();
+        for (size_t g = 0; g < groups; g++)
+            pushEdges((unsigned int)g);
+    }
+
+    // Collapse edges, cheapest first, until at most target triangles are
+    // left or no edge can collapse without flipping a triangle. Returns the
+    // largest error (a distance in model units) of all collapses so far.
+    float collapseTo(size_t target) {
+        while (liveTriangles > target && !heap.empty()) {
+            Collapse c = heap.top();
+            heap.pop();
+            if (collapsed[c.from] != c.from || collapsed[c.to] != c.to
+                || version[c.from] != c.fromVersion || version[c.to] != c.toVersion)
+                continue;
+            if (flips(c.from, c.to))
+                continue;
+            collapse(c.from, c.to);
+            float error = std::sqrt((std::max)(c.cost, 0.0));
+            maxError = (std::max)(maxError, error);
+        }
+        return maxError;
+    }
+
+    size_t triangleCount() const {
+        return liveTriangles;
+    }
+
+    // Append the live triangles to out, as indices into vertices
+    template <class V>
+    void emit(const std::vector<V>& vertices, std::vector<unsigned int>& out) const {
+        for (size_t t = 0; t < triangles.size(); t++) {
+            const Triangle& tri = triangles[t];
+            if (tri.dead)
+                continue;
+            for (int k = 0; k < 3; k++)
+                out.push_back(closestVertex(vertices, tri.vertex[k], tri.corner[k]));
+        }
+    }
+
+private:
+    struct Quadric {
+        // symmetric 4x4 matrix: a2 ab ac ad b2 bc bd c2 cd d2
+        double m[10];
+
+        Quadric() {
+            std::fill(m, m + 10, 0.0);
+        }
+
+        void addPlane(const glm::dvec3& n, double d, double weight) {
+            m[0] += weight * n.x * n.x; m[1] += weight * n.x * n.y; m[2] += weight * n.x * n.z; m[3] += weight * n.x * d;
+            m[4] += weight * n.y * n.y; m[5] += weight * n.y * n.z; m[6] += weight * n.y * d;
+            m[7] += weight * n.z * n.z; m[8] += weight * n.z * d;
+            m[9] += weight * d * d;
+        }
+
+        void add(const Quadric& q) {
+            for (int i = 0; i < 10; i++)
+                m[i] += q.m[i];
+        }
+
+        double error(const glm::dvec3& p) const {
+            return m[0] * p.x * p.x + 2.0 * m[1] * p.x * p.y + 2.0 * m[2] * p.x * p.z + 2.0 * m[3] * p.x
+                + m[4] * p.y * p.y + 2.0 * m[5] * p.y * p.z + 2.0 * m[6] * p.y
+                + m[7] * p.z * p.z + 2.0 * m[8] * p.z
+                + m[9];
+        }
+    };
+
+    struct Triangle {
+        // welded positions, and the vertex each corner had in the input
+        unsigned int corner[3];
+        unsigned int vertex[3];
+        bool dead;
+
+        Triangle() : dead(false) {
+        }
+    };
+
+    struct Collapse {
+        double cost;
+        unsigned int from, to;
+        unsigned int fromVersion, toVersion;
+
+        // priority_queue puts the largest first, we want the cheapest
+        bool operator<(const Collapse& other) const {
+            return cost > other.cost;
+        }
+    };
+
+    // welded position of every vertex, the positions, and the vertices of
+    // every position as one flat array
+    std::vector<unsigned int> group;
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> membersStart;
+    std::vector<unsigned int> members;
+
+    std::vector<Triangle> triangles;
+    size_t liveTriangles;
+    float maxError;
+
+    std::vector<Quadric> quadrics;
+    // the position a position was collapsed into, itself while it is alive
+    std::vector<unsigned int> collapsed;
+    // bumped whenever the quadric of a position changes, to drop stale collapses
+    std::vector<unsigned int> version;
+    // triangles around every position; dead ones are skipped and pruned lazily
+    std::vector<std::vector<unsigned int> > around;
+    std::priority_queue<Collapse> heap;
+    std::vector<unsigned int> neighbours;
+
+    template <class V>
+    void weld(const std::vector<V>& vertices) {
+        std::vector<unsigned int> order(vertices.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (unsigned int)i;
+        std::sort(order.begin(), order.end(), [&vertices](unsigned int a, unsigned int b) {
+            const glm::vec3& p = vertices[a].Position;
+            const glm::vec3& q = vertices[b].Position;
+            if (p.x != q.x)
+                return p.x < q.x;
+            if (p.y != q.y)
+                return p.y < q.y;
+            if (p.z != q.z)
+                return p.z < q.z;
+            return a < b;
+        });
+
+        group.resize(vertices.size());
+        positions.clear();
+        membersStart.clear();
+        members.swap(order);
+        for (size_t i = 0; i < members.size(); i++) {
+            const glm::vec3& p = vertices[members[i]].Position;
+            if (positions.empty() || positions.back() != p) {
+                positions.push_back(p);
+                membersStart.push_back((unsigned int)i);
+            }
+            group[members[i]] = (unsigned int)(positions.size() - 1);
+        }
+        membersStart.push_back((unsigned int)members.size());
+    }
+
+    void addQuadrics() {
+        for (size_t t = 0; t < triangles.size(); t++) {
+            const Triangle& tri = triangles[t];
+            glm::dvec3 p[3];
+            for (int k = 0; k < 3; k++)
+                p[k] = glm::dvec3(positions[tri.corner[k]]);
+            glm::dvec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+            double length = glm::length(n);
+            if (length == 0.0)
+                continue;
+            n /= length;
+            Quadric q;
+            q.addPlane(n, -glm::dot(n, p[0]), 1.0);
+            for (int k = 0; k < 3; k++)
+                quadrics[tri.corner[k]].add(q);
+
+            // an edge no other triangle shares is on the boundary: hold it
+            // with a plane through it, perpendicular to the face
+            for (int k = 0; k < 3; k++) {
+                unsigned int a = tri.corner[k], b = tri.corner[(k + 1) % 3];
+                if (sharedEdge(t, a, b))
+                    continue;
+                glm::dvec3 edge = p[(k + 1) % 3] - p[k];
+                glm::dvec3 side = glm::cross(edge, n);
+                double sideLength = glm::length(side);
+                if (sideLength == 0.0)
+                    continue;
+                side /= sideLength;
+                Quadric b2;
+                b2.addPlane(side, -glm::dot(side, p[k]), BoundaryWeight);
+                quadrics[a].add(b2);
+                quadrics[b].add(b2);
+            }
+        }
+    }
+
+    bool sharedEdge(size_t triangle, unsigned int a, unsigned int b) const {
+        const std::vector<unsigned int>& list = around[a];
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i] == triangle)
+                continue;
+            const Triangle& other = triangles[list[i]];
+            if (other.corner[0] == b || other.corner[1] == b || other.corner[2] == b)
+                return true;
+        }
+        return false;
+    }
+
+    // Queue the collapses of every edge at position g
+    void pushEdges(unsigned int g) {
+        neighbours.clear();
+        std::vector<unsigned int>& list = around[g];
+        size_t kept = 0;
+        for (size_t i = 0; i < list.size(); i++) {
+            const Triangle& tri = triangles[list[i]];
+            if (tri.dead)
+                continue;
+            list[kept++] = list[i];
+            for (int k = 0; k < 3; k++)
+                if (tri.corner[k] != g)
+                    neighbours.push_back(tri.corner[k]);
+        }
+        list.resize(kept);
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+        for (size_t i = 0; i < neighbours.size(); i++) {
+            unsigned int n = neighbours[i];
+            Quadric q = quadrics[g];
+            q.add(quadrics[n]);
+            // either end may move onto the other, keep the cheaper direction
+            double toNeighbour = q.error(glm::dvec3(positions[n]));
+            double toSelf = q.error(glm::dvec3(positions[g]));
+            Collapse c;
+            c.cost = (std::min)(toNeighbour, toSelf);
+            c.from = toNeighbour <= toSelf ? g : n;
+            c.to = toNeighbour <= toSelf ? n : g;
+            c.fromVersion = version[c.from];
+            c.toVersion = version[c.to];
+            heap.push(c);
+        }
+    }
+
+    // true if moving from onto to turns any surviving triangle around
+    bool flips(unsigned int from, unsigned int to) const {
+        const std::vector<unsigned int>& list = around[from];
+        for (size_t i = 0; i < list.size(); i++) {
+            const Triangle& tri = triangles[list[i]];
+            if (tri.dead || tri.corner[0] == to || tri.corner[1] == to || tri.corner[2] == to)
+                continue;
+            glm::vec3 p[3], q[3];
+            for (int k = 0; k < 3; k++) {
+                p[k] = positions[tri.corner[k]];
+                q[k] = tri.corner[k] == from ? positions[to] : p[k];
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+            if (glm::dot(before, after) <= 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+    void collapse(unsigned int from, unsigned int to) {
+        collapsed[from] = to;
+        quadrics[to].add(quadrics[from]);
+        version[to]++;
+
+        std::vector<unsigned int>& list = around[from];
+        for (size_t i = 0; i < list.size(); i++) {
+            Triangle& tri = triangles[list[i]];
+            if (tri.dead)
+                continue;
+            for (int k = 0; k < 3; k++)
+                if (tri.corner[k] == from)
+                    tri.corner[k] = to;
+            if (tri.corner[0] == tri.corner[1] || tri.corner[1] == tri.corner[2] || tri.corner[0] == tri.corner[2]) {
+                tri.dead = true;
+                liveTriangles--;
+            }
+            else {
+                around[to].push_back(list[i]);
+            }
+        }
+        std::vector<unsigned int>().swap(list);
+
+        pushEdges(to);
+    }
+
+    // The vertex at position g whose attributes are closest to those of vertex
+    // (which was at some position collapsed into g)
+    template <class V>
+    unsigned int closestVertex(const std::vector<V>& vertices, unsigned int vertex, unsigned int g) const {
+        if (group[vertex] == g)
+            return vertex;
+        const V& source = vertices[vertex];
+        unsigned int best = members[membersStart[g]];
+        float bestDistance = -1.0f;
+        for (unsigned int i = membersStart[g]; i < membersStart[g + 1]; i++) {
+            const V& candidate = vertices[members[i]];
+            glm::vec3 dn = candidate.Normal - source.Normal;
+            glm::vec2 dt = candidate.TexCoords - source.TexCoords;
+            float distance = glm::dot(dn, dn) + glm::dot(dt, dt);
+            if (bestDistance < 0.0f || distance < bestDistance) {
+                bestDistance = distance;
+                best = members[i];
+            }
+        }
+        return best;
+    }
+};
@@ -12,6 +12,14 @@
 #include "ObjLoader.h"
 #include "StlLoader.h"
 #include "3DSLoader.h"
+#include "MeshCache.h"
+#include "ThreadPool.h"
+#include "RenderQueue.h"
+#include "MeshArena.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "Frustum.h"
+#include "Bvh.h"
 
 #include <string>
 #include <fstream>
@@ -20,9 +28,35 @@
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <cfloat>
 using namespace std;
 
+// Pixels of an image file as decoded by stb_image, data is NULL if it failed
+struct TextureImage {
+    string filename;
+    unsigned char* data;
+    int width, height, nrComponents;
+};
+
+// Nearest triangle a ray hits, in model space
+struct RayHit {
+    // along the ray, in units of the direction's length
+    float distance;
+    unsigned int mesh;
+    // triangle of the full level of detail of the mesh
+    unsigned int triangle;
+    glm::vec3 position;
+};
+
+// returns 0 if the image cannot be loaded
 unsigned int TextureFromFile(const char *path, const string &directory);
+// decoding only, safe to call from worker threads
+TextureImage DecodeTexture(const string &filename);
+// creates the GL texture and frees the pixels, returns 0 for a failed decode
+unsigned int UploadTexture(TextureImage &image);
 
 class Model {
 public:
@@ -30,41 +64,567 @@ public:
     vector<Mesh> meshes;
     string directory;
     bool gammaCorrection;
+    // texture cache statistics: hits reuse a loaded texture, misses decode a file
+    unsigned int textureHits = 0;
+    unsigned int textureMisses = 0;
+
+    // levels of detail generateLods builds per mesh, the full one included
+    static const unsigned int MaxLods = 8;
+    // meshes are not simplified below this many triangles
+    static const size_t MinLodTriangles = 64;
+
+    enum LoadMode {
+        // the constructor returns with the model on the GPU
+        LoadBlocking,
+        // the constructor returns at once; parsing runs on a worker thread and
+        // update() has to be called every frame to upload the result
+        LoadInBackground
+    };
+
+    // useCache: load from (and refresh) the binary cache next to the source file
+    // vertexFormat: VertexCompact halves the vertex memory (see VertexFormat.h)
+    // optimize: reorder triangles and vertices for the post-transform cache (see MeshOptimizer.h)
+    // generateLods: add simplified levels of detail to every mesh (see MeshSimplifier.h)
+    // normalWeighting: how the vertex normals of a 3DS file are averaged (see 3DSLoader.h)
+    Model(string const &path, bool gamma = false, bool useCache = true, LoadMode mode = LoadBlocking,
+        VertexFormat vertexFormat = VertexFloat, bool optimize = false, bool generateLods = false,
+        Simple3DS::NormalWeighting normalWeighting = Simple3DS::WeightByArea)
+        : gammaCorrection(gamma), normalWeighting(normalWeighting) {
+        size_t slash = path.find_last_of("/\\");
+        directory = slash == string::npos ? "." : path.substr(0, slash);
+        if (mode == LoadInBackground) {
+            loading = async(launch::async, [this, path, useCache, vertexFormat, optimize, generateLods]() {
+                prepare(path, useCache, vertexFormat, optimize, generateLods);
+            });
+            return;
+        }
+        prepare(path, useCache, vertexFormat, optimize, generateLods);
+        update(-1.0);
+    }
+
+    ~Model() {
+        // the worker still writes into this model
+        if (loading.valid())
+            loading.wait();
+    }
+
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    // Upload whatever the load has produced, spending about budgetSeconds on
+    // it (at least one staging chunk per call, no limit if negative).
+    // Returns true once the whole model is on the GPU.
+    bool update(double budgetSeconds) {
+        if (loaded)
+            return true;
+        if (loading.valid()) {
+            if (loading.wait_for(chrono::seconds(0)) != future_status::ready)
+                return false;
+            loading.get();
+        }
+
+        chrono::steady_clock::time_point deadline = chrono::steady_clock::now()
+            + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(budgetSeconds));
+        bool limited = budgetSeconds >= 0.0;
+        if (!uploadDecodedTextures(limited, deadline))
+            return false;
+
+        if (!texturesResolved) {
+            for (size_t i = 0; i < meshes.size(); i++)
+                for (size_t t = 0; t < meshes[i].textures.size(); t++)
+                    meshes[i].textures[t].id = loadTexture(meshes[i].textures[t].path);
+            texturesResolved = true;
+        }
+
+        // all meshes share one set of buffers; stream them in chunk by chunk,
+        // so a huge mesh is spread over frames
+        if (!arena.isBuilt() && !meshes.empty())
+            arena.build(meshes);
+        if (!staging)
+            staging.reset(new StagingRing());
+        size_t stepBytes = limited ? staging->chunkSize() : (size_t)-1;
+        do {
+            if (uploadedMeshes == meshes.size())
+                break;
+            if (meshes[uploadedMeshes].uploadStep(*staging, stepBytes))
+                uploadedMeshes++;
+        } while (!limited || chrono::steady_clock::now() < deadline);
+        if (uploadedMeshes < meshes.size())
+            return false;
+
+        staging.reset();
+        loaded = true;
+        printTextureStats();
+        return true;
+    }
+
+    bool isLoaded() const {
+        return loaded;
+    }
+
+    // 0 while parsing, then the fraction of meshes on the GPU
+    float loadProgress() const {
+        if (loaded)
+            return 1.0f;
+        if (loading.valid() || meshes.empty())
+            return 0.0f;
+        return (float)uploadedMeshes / meshes.size();
+    }
+
+    // Meshes are sorted by state and drawn without redundant binds;
+    // meshes that are not uploaded yet are skipped. Nothing is drawn while
+    // the loading thread still fills meshes.
+    void Draw(const Shader &shader) const {
+        renderQueue.clear();
+        if (loading.valid())
+            return;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            renderQueue.submit(shader, meshes[i]);
+        renderQueue.flush();
+    }
+
+    // Draw the meshes inside the view frustum, each at the coarsest level of
+    // detail whose error projects to at most maxPixelError pixels, for a
+    // perspective projection onto a viewport viewportHeight pixels high.
+    // Nothing is drawn while the loading thread still fills meshes.
+    void Draw(const Shader &shader, const glm::mat4 &modelView, const glm::mat4 &projection, float viewportHeight,
+        float maxPixelError = 1.0f) const {
+        renderQueue.clear();
+        if (loading.valid())
+            return;
+        Frustum frustum(projection * modelView);
+
+        // the largest scale of the model matrix, and pixels per model unit at distance 1
+        float scale = 0.0f;
+        for (int i = 0; i < 3; i++)
+            scale = (glm::max)(scale, glm::length(glm::vec3(modelView[i])));
+        float pixelsPerUnit = scale * projection[1][1] * viewportHeight * 0.5f;
+
+        size_t visible = 0;
+        auto drawMesh = [&](unsigned int i) {
+            const Mesh& mesh = meshes[i];
+            // the sphere rejects most meshes, the box the ones near the corners
+            if (!frustum.intersects(mesh.boundsCenter, mesh.boundsRadius)
+                || !frustum.intersects(mesh.boundsMin, mesh.boundsMax))
+                return;
+            // distance to the nearest point of the bounding sphere
+            glm::vec4 centre = modelView * glm::vec4(mesh.boundsCenter, 1.0f);
+            float distance = -centre.z - mesh.boundsRadius * scale;
+            size_t level = 0;
+            if (distance > 0.0f)
+                while (level + 1 < mesh.lodCount() && mesh.lod(level + 1).error * pixelsPerUnit / distance <= maxPixelError)
+                    level++;
+            renderQueue.submit(shader, mesh, level);
+            visible++;
+        };
+        // the hierarchy skips whole groups of meshes at once
+        meshTree.cull(frustum, drawMesh);
+        renderQueue.cull(meshes.size() - visible);
+        renderQueue.flush();
+    }
+
+    // Nearest hit of the ray origin + t * direction (t >= 0) on the full
+    // detail of the model, in model space. Builds the triangle hierarchy on
+    // the first call; always misses while the model is still loading.
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, RayHit &hit) {
+        if (loading.valid() || meshes.empty())
+            return false;
+        if (triangleTree.empty())
+            buildTriangleBvh();
+        float tMax = FLT_MAX;
+        bool found = triangleTree.intersect(origin, direction, tMax, [&](unsigned int primitive, float &t) {
+            // the mesh whose range of triangles holds primitive
+            unsigned int m = (unsigned int)(upper_bound(meshFirstTriangle.begin(), meshFirstTriangle.end(), primitive) - meshFirstTriangle.begin()) - 1;
+            const Mesh& mesh = meshes[m];
+            unsigned int triangle = primitive - meshFirstTriangle[m];
+            const unsigned int* index = &mesh.indices[mesh.lod(0).firstIndex + triangle * 3];
+            if (!intersectTriangle(origin, direction, mesh.vertices[index[0]].Position, mesh.vertices[index[1]].Position,
+                mesh.vertices[index[2]].Position, t))
+                return false;
+            hit.mesh = m;
+            hit.triangle = triangle;
+            return true;
+        });
+        if (!found)
+            return false;
+        hit.distance = tMax;
+        hit.position = origin + direction * tMax;
+        return true;
+    }
+
+    // The triangle under pixel (x, y) of a viewport width x height pixels,
+    // y growing downwards as window systems report the cursor
+    bool pick(const glm::mat4 &modelView, const glm::mat4 &projection, float x, float y, float width, float height, RayHit &hit) {
+        glm::mat4 unproject = glm::inverse(projection * modelView);
+        glm::vec2 ndc(2.0f * x / width - 1.0f, 1.0f - 2.0f * y / height);
+        glm::vec4 nearPoint = unproject * glm::vec4(ndc, -1.0f, 1.0f);
+        glm::vec4 farPoint = unproject * glm::vec4(ndc, 1.0f, 1.0f);
+        glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+        return intersect(origin, glm::vec3(farPoint) / farPoint.w - origin, hit);
+    }
+
+    // Hierarchy over the bounds of the meshes, used to cull them; built
+    // with the model
+    const Bvh& meshBvh() const {
+        return meshTree;
+    }
+
+    // Hierarchy over every triangle, used to pick; empty until the first
+    // intersect or buildTriangleBvh
+    const Bvh& triangleBvh() const {
+        return triangleTree;
+    }
+
+    void buildMeshBvh(unsigned int threadCount = 0) {
+        vector<glm::vec3> boxMin(meshes.size()), boxMax(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++) {
+            boxMin[i] = meshes[i].boundsMin;
+            boxMax[i] = meshes[i].boundsMax;
+        }
+        meshTree.build(boxMin, boxMax, threadCount);
+    }
+
+    // Over the full level of detail of every mesh
+    void buildTriangleBvh(unsigned int threadCount = 0) {
+        meshFirstTriangle.assign(1, 0);
+        for (size_t i = 0; i < meshes.size(); i++)
+            meshFirstTriangle.push_back(meshFirstTriangle.back() + meshes[i].lod(0).indexCount / 3);
+        vector<glm::vec3> boxMin(meshFirstTriangle.back()), boxMax(meshFirstTriangle.back());
+        size_t t = 0;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const Mesh& mesh = meshes[i];
+            MeshLod full = mesh.lod(0);
+            for (unsigned int j = full.firstIndex; j + 2 < full.firstIndex + full.indexCount; j += 3, t++) {
+                const glm::vec3& a = mesh.vertices[mesh.indices[j]].Position;
+                const glm::vec3& b = mesh.vertices[mesh.indices[j + 1]].Position;
+                const glm::vec3& c = mesh.vertices[mesh.indices[j + 2]].Position;
+                boxMin[t] = (glm::min)(a, (glm::min)(b, c));
+                boxMax[t] = (glm::max)(a, (glm::max)(b, c));
+            }
+        }
+        triangleTree.build(boxMin, boxMax, threadCount);
+    }
+
+    // state changes made by the last Draw
+    const RenderStats& renderStats() const {
+        return renderQueue.stats();
+    }
+
+private:
+    // resolved texture path -> texture id, so every file is loaded once
+    map<string, unsigned int> textureCache;
+    // shared by all empty or unloadable maps
+    unsigned int whiteTexture = 0;
+
+    // Textures being decoded on texturePool, keyed like textureCache
+    struct PendingTexture {
+        string path;
+        future<TextureImage> image;
+    };
+    map<string, PendingTexture> pendingTextures;
+    unique_ptr<ThreadPool> texturePool;
+
+    // Background load state
+    future<void> loading;
+    size_t uploadedMeshes = 0;
+    bool texturesResolved = false;
+    bool loaded = false;
+    unique_ptr<StagingRing> staging;
+
+    MeshArena arena;
+    mutable RenderQueue renderQueue;
+
+    Bvh meshTree;
+    Bvh triangleTree;
+    // index of the first triangle of every mesh in triangleTree, and the total at the end
+    vector<unsigned int> meshFirstTriangle;
+    // other files the source was built from (.mtl libraries), the cache is
+    // stale once one of them changes
+    vector<string> sourceDependencies;
+    Simple3DS::NormalWeighting normalWeighting;
+
+    // CPU side of loading: parse the file (or map its cache) into meshes that
+    // are not on the GPU yet, and start decoding their textures. No GL calls,
+    // so this can run on a worker thread.
+    void build(string const &path, bool useCache) {
+        if (useCache && loadCache(path, normalWeighting))
+            return;
 
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma) {
-        directory = path.substr(0, path.find_last_of('/'));
         string ext = path.substr(path.size() - 4, 4);
-        transform(ext.begin(), ext.end(), ext.begin(), tolower);
+        transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
         if (ext == ".obj") {
             loadObj(path);
         }
         else if (ext == ".stl") {
-            Mesh mesh = loadStl(path);
-            this->meshes.push_back(mesh);
+            this->meshes.push_back(loadStl(path));
         }
         else if (ext == ".3ds") {
             load3ds(path);
         }
         else {
             cout << "cannot find the file or the file is unsupported" << endl;
+            return;
         }
+        if (useCache && !meshes.empty() && !MeshCache::write(path, meshes, sourceDependencies, normalWeighting))
+            cout << "cannot write mesh cache " << MeshCache::pathFor(path) << endl;
     }
 
-    void Draw(Shader shader) {
-        for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+    // build, then the optional CPU passes over the geometry
+    void prepare(string const &path, bool useCache, VertexFormat vertexFormat, bool optimize, bool generateLods) {
+        build(path, useCache);
+        if (generateLods)
+            simplifyMeshes();
+        if (optimize)
+            optimizeMeshes();
+        if (vertexFormat == VertexCompact)
+            compactMeshes();
+        buildMeshBvh();
     }
 
-private:
+    // Append up to MaxLods - 1 levels to every mesh, each with about half the
+    // triangles of the one before, and report the triangles per level
+    void simplifyMeshes() {
+        MeshSimplifier simplifier;
+        vector<size_t> levelTriangles(MaxLods, 0);
+        for (size_t i = 0; i < meshes.size(); i++) {
+            Mesh& mesh = meshes[i];
+            MeshLod full = { 0, (unsigned int)mesh.indices.size(), 0.0f };
+            mesh.lods.assign(1, full);
+            levelTriangles[0] += mesh.indices.size() / 3;
+
+            simplifier.begin(mesh.vertices, mesh.indices);
+            size_t previous = mesh.indices.size() / 3;
+            for (unsigned int level = 1; level < MaxLods; level++) {
+                if (previous / 2 < MinLodTriangles)
+                    break;
+                float error = simplifier.collapseTo(previous / 2);
+                // stop when the mesh hardly simplifies any more
+                if (simplifier.triangleCount() * 10 > previous * 9)
+                    break;
+                MeshLod lod = { (unsigned int)mesh.indices.size(), 0, error };
+                simplifier.emit(mesh.vertices, mesh.indices);
+                lod.indexCount = (unsigned int)(mesh.indices.size() - lod.firstIndex);
+                mesh.lods.push_back(lod);
+                previous = simplifier.triangleCount();
+                levelTriangles[level] += previous;
+            }
+        }
+        cout << "levels of detail, triangles:";
+        for (unsigned int level = 0; level < MaxLods && levelTriangles[level]; level++)
+            cout << " " << levelTriangles[level];
+        cout << endl;
+    }
+
+    // Reorder every mesh for the vertex cache and for fetching, and report
+    // the cache efficiency of the full detail before and after. Each level
+    // of detail is ordered on its own.
+    void optimizeMeshes() {
+        MeshOptimizer optimizer;
+        VertexCacheStats before, after;
+        vector<unsigned int> range;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            Mesh& mesh = meshes[i];
+            for (size_t level = 0; level < mesh.lodCount(); level++) {
+                MeshLod lod = mesh.lod(level);
+                range.assign(mesh.indices.begin() + lod.firstIndex, mesh.indices.begin() + lod.firstIndex + lod.indexCount);
+                if (level == 0)
+                    before += MeshOptimizer::analyzeVertexCache(range, mesh.vertices.size());
+                optimizer.optimizeVertexCache(mesh.vertices, range);
+                if (level == 0)
+                    after += MeshOptimizer::analyzeVertexCache(range, mesh.vertices.size());
+                std::copy(range.begin(), range.end(), mesh.indices.begin() + lod.firstIndex);
+            }
+            optimizer.optimizeVertexFetch(mesh.vertices, mesh.indices);
+        }
+        cout << "vertex cache: ACMR " << before.acmr() << " -> " << after.acmr()
+            << ", ATVR " << before.atvr() << " -> " << after.atvr() << endl;
+    }
+
+    // Quantize every mesh inside the bounding box of the whole model, so they
+    // all share one decode and still merge into the same multi draw
+    void compactMeshes() {
+        if (meshes.empty())
+            return;
+        glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+        for (size_t i = 0; i < meshes.size(); i++)
+            for (size_t j = 0; j < meshes[i].vertices.size(); j++) {
+                boxMin = glm::min(boxMin, meshes[i].vertices[j].Position);
+                boxMax = glm::max(boxMax, meshes[i].vertices[j].Position);
+            }
+        if (boxMin.x > boxMax.x)
+            return;
+        for (size_t i = 0; i < meshes.size(); i++)
+            meshes[i].compact(boxMin, boxMax);
+    }
+
+    // Moller-Trumbore: true if the ray hits triangle abc closer than t, which
+    // becomes the distance of the hit
+    static bool intersectTriangle(const glm::vec3 &origin, const glm::vec3 &direction,
+        const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, float &t) {
+        glm::vec3 ab = b - a, ac = c - a;
+        glm::vec3 p = glm::cross(direction, ac);
+        float det = glm::dot(ab, p);
+        // parallel to the plane of the triangle, or degenerate
+        if (det == 0.0f)
+            return false;
+        float inverse = 1.0f / det;
+        glm::vec3 s = origin - a;
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, ab);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        float distance = glm::dot(ac, q) * inverse;
+        if (distance < 0.0f || distance >= t)
+            return false;
+        t = distance;
+        return true;
+    }
+
+    // Rebuild the meshes from a fresh cache, the geometry is copied straight
+    // out of the mapping and only the textures are loaded again
+    bool loadCache(string const &path, unsigned int options) {
+        MeshCache cache;
+        if (!cache.open(path, options))
+            return false;
+        this->meshes.reserve(cache.meshCount());
+        for (size_t i = 0; i < cache.meshCount(); i++)
+            for (unsigned int t = 0; t < cache.mesh(i).textureCount; t++)
+                prefetchTexture(cache.texturePath(i, t));
+
+        for (size_t i = 0; i < cache.meshCount(); i++) {
+            const MeshCache::MeshEntry& entry = cache.mesh(i);
+            vector<Texture> textures;
+            for (unsigned int t = 0; t < entry.textureCount; t++)
+                textures.push_back(material2Texture(cache.texturePath(i, t), cache.textureType(i, t)));
+            vector<Vertex> vertices(cache.vertices(i), cache.vertices(i) + entry.vertexCount);
+            vector<unsigned int> indices(cache.indices(i), cache.indices(i) + entry.indexCount);
+            this->meshes.push_back(Mesh(std::move(vertices), std::move(indices), textures, false));
+        }
+        return true;
+    }
+
+    // the id is filled in by update
     Texture material2Texture(string path, string type) {
         Texture texture;
-        texture.id = TextureFromFile(path.c_str(), this->directory);
+        texture.id = 0;
         texture.type = type;
-        texture.path = path.c_str();
+        texture.path = path;
         return texture;
     }
 
-    Mesh objl2Mesh(ObjMesh objl_mesh) {
+    unsigned int loadTexture(const string& path) {
+        if (path.empty())
+            return fallbackTexture();
+
+        string resolved = this->directory + '/' + path;
+        map<string, unsigned int>::iterator found = textureCache.find(resolved);
+        if (found != textureCache.end()) {
+            textureHits++;
+            return found->second;
+        }
+
+        map<string, PendingTexture>::iterator pending = pendingTextures.find(resolved);
+        TextureImage image;
+        if (pending != pendingTextures.end()) {
+            image = pending->second.image.get();
+            pendingTextures.erase(pending);
+        }
+        else {
+            image = DecodeTexture(resolved);
+        }
+        return addTexture(resolved, path, image);
+    }
+
+    unsigned int addTexture(const string& resolved, const string& path, TextureImage& image) {
+        textureMisses++;
+        unsigned int id = UploadTexture(image);
+        if (id == 0) {
+            id = fallbackTexture();
+        }
+        else {
+            Texture texture;
+            texture.id = id;
+            texture.type = "";
+            texture.path = path;
+            textures_loaded.push_back(texture);
+        }
+        textureCache[resolved] = id;
+        return id;
+    }
+
+    // Start decoding a texture on the worker threads, so the GL thread only
+    // has to upload it (in uploadDecodedTextures or the first loadTexture)
+    void prefetchTexture(const string& path) {
+        if (path.empty())
+            return;
+        string resolved = this->directory + '/' + path;
+        if (textureCache.count(resolved) || pendingTextures.count(resolved))
+            return;
+        if (!texturePool)
+            texturePool.reset(new ThreadPool());
+        PendingTexture& pending = pendingTextures[resolved];
+        pending.path = path;
+        pending.image = texturePool->enqueue([resolved]() { return DecodeTexture(resolved); });
+    }
+
+    // Upload the prefetched textures in the order their decodes finish.
+    // If limited, only finished decodes are uploaded until the deadline;
+    // returns true once none are left.
+    bool uploadDecodedTextures(bool limited, chrono::steady_clock::time_point deadline) {
+        while (!pendingTextures.empty()) {
+            bool uploaded = false;
+            for (map<string, PendingTexture>::iterator it = pendingTextures.begin(); it != pendingTextures.end();) {
+                if (it->second.image.wait_for(chrono::seconds(0)) == future_status::ready) {
+                    TextureImage image = it->second.image.get();
+                    addTexture(it->first, it->second.path, image);
+                    it = pendingTextures.erase(it);
+                    uploaded = true;
+                    if (limited && chrono::steady_clock::now() >= deadline)
+                        return pendingTextures.empty();
+                }
+                else {
+                    ++it;
+                }
+            }
+            if (!uploaded) {
+                if (limited)
+                    return false;
+                pendingTextures.begin()->second.image.wait();
+            }
+        }
+        texturePool.reset();
+        return true;
+    }
+
+    void prefetchMaterial(const Material& material) {
+        prefetchTexture(material.map_Kd);
+        prefetchTexture(material.map_Ks);
+        prefetchTexture(material.map_Ka);
+        prefetchTexture(material.map_bump);
+    }
+
+    // 1x1 white texture, so unmapped samplers don't darken the material
+    unsigned int fallbackTexture() {
+        if (whiteTexture == 0) {
+            const unsigned char white[4] = { 255, 255, 255, 255 };
+            glGenTextures(1, &whiteTexture);
+            glBindTexture(GL_TEXTURE_2D, whiteTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+        return whiteTexture;
+    }
+
+    void printTextureStats() {
+        if (textureHits + textureMisses > 0)
+            cout << "textures: " << textures_loaded.size() << " loaded, " << textureHits << " cache hits, " << textureMisses << " misses" << endl;
+    }
+
+    Mesh objl2Mesh(ObjMesh& objl_mesh) {
         Material material = objl_mesh.ObjMeshMaterial;
         vector<Texture> textures;
 
@@ -80,55 +640,71 @@ private:
         Texture bump_texture = material2Texture(material.map_bump, "texture_normal");
         textures.push_back(bump_texture);
 
-        return Mesh(objl_mesh.Vertices, objl_mesh.Indices, textures);
+        return Mesh(std::move(objl_mesh.Vertices), std::move(objl_mesh.Indices), textures, false);
     }
 
     void loadObj(string const &path) {
-        ObjLoader Loader(path);
+        // texture decoding starts as soon as the .mtl is parsed and overlaps the geometry
+        ObjLoader Loader(path, 0, [this](const Material& material) { prefetchMaterial(material); });
+        sourceDependencies = Loader.MaterialLibraries;
+        this->meshes.reserve(Loader.LoadedObjMeshes.size());
         for (int i = 0; i < Loader.LoadedObjMeshes.size(); i++) {
-            ObjMesh curMesh = Loader.LoadedObjMeshes[i];
-            this->meshes.push_back(objl2Mesh(curMesh));
+            // hand the geometry over instead of copying it, and free each ObjMesh once consumed
+            this->meshes.push_back(objl2Mesh(Loader.LoadedObjMeshes[i]));
+            Loader.LoadedObjMeshes[i] = ObjMesh();
         }
     }
 
+    // A 3DS vertex already has one position and texture coordinate, so every
+    // vertex is emitted once per normal it has (just once without smoothing
+    // groups) and the faces keep their indices. Vertices are numbered in the
+    // order the faces first use them; ones no face uses are left out, as are
+    // faces with an index out of range.
     Mesh _3ds2mesh(Simple3DS::Object* obj, vector<Texture> textures) {
+        const vector<Simple3DS::Triangle>& faces = obj->getTriangles();
+        const vector<Simple3DS::Vertex>& positions = obj->getVertices();
+        const vector<Simple3DS::TextureCoord>& texCoords = obj->getTextureCoords();
+        const vector<Simple3DS::Normal>& normals = obj->getNormals();
+        const vector<Simple3DS::u32>& normalIndices = obj->getNormalIndices();
         vector<Vertex> Vertices;
         vector<unsigned int> Indices;
-        for (int i = 0; i < obj->getNumOfTriangles(); i++) {
-            Simple3DS::Triangle* face = obj->getTriangle(i);
+        // a normal belongs to one vertex, so it identifies the output vertex
+        vector<unsigned int> remap(normals.size(), (unsigned int)-1);
+        Vertices.reserve(normals.size());
+        Indices.reserve(faces.size() * 3);
+        for (size_t i = 0; i < faces.size(); i++) {
+            const Simple3DS::u16* index = faces[i].index;
+            if (index[0] >= positions.size() || index[1] >= positions.size() || index[2] >= positions.size())
+                continue;
             for (int j = 0; j < 3; j++) {
-                Vertex vertex;
-                Simple3DS::Vertex* v = obj->getVertex(face->index[j]);
-                Simple3DS::TextureCoord* tc = obj->getTextureCoord(face->index[j]);
-                Simple3DS::Normal* n = obj->getNormal(face->index[j]);
-                vertex.Position.x = v->x;
-                vertex.Position.y = v->y;
-                vertex.Position.z = v->z;
-                vertex.TexCoords.x = tc->u;
-                vertex.TexCoords.y = tc->v;
-                vertex.Normal.x = n->nx;
-                vertex.Normal.y = n->ny;
-                vertex.Normal.z = n->nz;
-                Vertices.push_back(vertex);
+                unsigned int normal = normalIndices.empty() ? index[j] : normalIndices[i * 3 + j];
+                unsigned int& target = remap[normal];
+                if (target == (unsigned int)-1) {
+                    target = (unsigned int)Vertices.size();
+                    Vertex vertex;
+                    const Simple3DS::Vertex& v = positions[index[j]];
+                    const Simple3DS::Normal& n = normals[normal];
+                    vertex.Position = glm::vec3(v.x, v.y, v.z);
+                    vertex.Normal = glm::vec3(n.nx, n.ny, n.nz);
+                    // objects without a UV chunk have no texture coordinates
+                    vertex.TexCoords = index[j] < texCoords.size() ? glm::vec2(texCoords[index[j]].u, texCoords[index[j]].v) : glm::vec2(0.0f);
+                    Vertices.push_back(vertex);
+                }
+                Indices.push_back(target);
             }
         }
-        for (int i = 0; i < obj->getNumOfTriangles() * 3; i++) {
-            Indices.push_back(i);
-        }
-        return Mesh(Vertices, Indices, textures);
+        return Mesh(std::move(Vertices), std::move(Indices), textures, false);
     }
 
     Texture material2Texture(Simple3DS::Material* material, string type) {
-        Texture texture;
-        texture.id = TextureFromFile(material->getFileName().c_str(), this->directory);
-        texture.type = type;
-        texture.path = material->getFileName().c_str();
-        return texture;
+        return material2Texture(material->getFileName(), type);
     }
     void load3ds(string const& path) {
         // second argument determines if the Y & Z axis should be swapped.
-        Simple3DS::Model3DS model(path,true);  
+        Simple3DS::Model3DS model(path, true, normalWeighting);
         vector<Texture> textures;
+        for (int i = 0; i < model.data.getNumOfMaterials(); i++)
+            prefetchTexture(model.data.getMaterial(i)->getFileName());
         for (int i = 0; i < model.data.getNumOfMaterials(); i++) {
             Texture texture = material2Texture(model.data.getMaterial(i), "texture_diffuse");
             textures.push_back(texture);
@@ -140,10 +716,11 @@ private:
     }
 
     Mesh loadStl(string const &path) {
-        STLreader* stlLoader = new STLreader(path);
-        std::vector<glm::vec3> vertices = stlLoader->getVertices();
+        STLreader stlLoader(path);
+        const std::vector<glm::vec3>& vertices = stlLoader.getVertices();
 
         vector<Vertex> mesh_vertices;
+        mesh_vertices.reserve(vertices.size());
         for (const auto& vertex : vertices) {
             Vertex mesh_vertex;
             mesh_vertex.Position = vertex;
@@ -153,46 +730,54 @@ private:
 
         }
         vector<unsigned int> mesh_indices;
-        for (unsigned int i = 0; i < stlLoader->getNumberOfFaces() * 3; i++) {
+        mesh_indices.reserve(vertices.size());
+        for (unsigned int i = 0; i < stlLoader.getNumberOfFaces() * 3; i++) {
             mesh_indices.push_back(i);
         }
         vector<Texture> textures;
-        return Mesh(mesh_vertices, mesh_indices, textures);
+        return Mesh(std::move(mesh_vertices), std::move(mesh_indices), textures, false);
     }
 };
 
 unsigned int TextureFromFile(const char *path, const string &directory) {
-    string filename = string(path);
-    filename = directory + '/' + filename;
+    TextureImage image = DecodeTexture(directory + '/' + string(path));
+    return UploadTexture(image);
+}
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+TextureImage DecodeTexture(const string &filename) {
+    TextureImage image;
+    image.filename = filename;
+    image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.nrComponents, 0);
+    return image;
+}
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data) {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
+unsigned int UploadTexture(TextureImage &image) {
+    if (!image.data) {
+        // no texture object for files that cannot be decoded, the caller falls back
+        cout << "Texture failed to load at path: " << image.filename << endl;
+        return 0;
+    }
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    GLenum format = GL_RGBA;
+    if (image.nrComponents == 1)
+        format = GL_RED;
+    else if (image.nrComponents == 2)
+        format = GL_RG;
+    else if (image.nrComponents == 3)
+        format = GL_RGB;
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+    glGenerateMipmap(GL_TEXTURE_2D);
 
-        stbi_image_free(data);
-    }
-    else {
-        stbi_image_free(data);
-    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    stbi_image_free(image.data);
+    image.data = NULL;
     return textureID;
-}
\ No newline at end of file
+}
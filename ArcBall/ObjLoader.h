@@ -4,6 +4,11 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <functional>
 #include <math.h>
 
 #define GLM_ENABLE_EXPERIMENTAL
@@ -12,6 +17,10 @@
 #include <glm/gtx/vector_angle.hpp>
 #include <glm/gtx/projection.hpp>
 
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "Triangulator.h"
+
 struct Material {
     Material() {
         name;
@@ -53,9 +62,8 @@ struct Material {
 struct ObjMesh {
     ObjMesh() {
     }
-    ObjMesh(std::vector<Vertex>& _Vertices, std::vector<unsigned int>& _Indices) {
-        Vertices = _Vertices;
-        Indices = _Indices;
+    ObjMesh(std::vector<Vertex> _Vertices, std::vector<unsigned int> _Indices)
+        : Vertices(std::move(_Vertices)), Indices(std::move(_Indices)) {
     }
     std::string ObjMeshName;
     std::vector<Vertex> Vertices;
@@ -64,52 +72,52 @@ struct ObjMesh {
     Material ObjMeshMaterial;
 };
 
-namespace algorithm {
-    // A test to see if P1 is on the same side as P2 of a line segment ab
-    bool SameSide(glm::vec3 p1, glm::vec3 p2, glm::vec3 a, glm::vec3 b) {
-        glm::vec3 cp1 = glm::cross(b - a, p1 - a);
-        glm::vec3 cp2 = glm::cross(b - a, p2 - a);
-
-        if (glm::dot(cp1, cp2) >= 0)
-            return true;
-        else
-            return false;
+// Read-only view of every ObjMesh as one vertex array and one index array,
+// with indices rebased to that array. Nothing is copied, so the loader
+// keeps a single copy of the geometry.
+class ObjGlobalView {
+public:
+    explicit ObjGlobalView(const std::vector<ObjMesh>& meshes) : Meshes(&meshes) {
+        VertexStart.push_back(0);
+        IndexStart.push_back(0);
+        for (size_t i = 0; i < meshes.size(); i++) {
+            VertexStart.push_back(VertexStart.back() + meshes[i].Vertices.size());
+            IndexStart.push_back(IndexStart.back() + meshes[i].Indices.size());
+        }
     }
 
-    // Generate a cross produect normal for a triangle
-    glm::vec3 GenTriNormal(glm::vec3 t1, glm::vec3 t2, glm::vec3 t3) {
-        glm::vec3 u = t2 - t1;
-        glm::vec3 v = t3 - t1;
+    size_t VertexCount() const { return VertexStart.back(); }
+    size_t IndexCount() const { return IndexStart.back(); }
 
-        glm::vec3 normal = glm::cross(u, v);
-
-        return normal;
+    const Vertex& GetVertex(size_t i) const {
+        size_t m = MeshOf(VertexStart, i);
+        return (*Meshes)[m].Vertices[i - VertexStart[m]];
     }
 
-    // Check to see if a glm::vec3 Point is within a 3 glm::vec3 Triangle
-    bool inTriangle(glm::vec3 point, glm::vec3 tri1, glm::vec3 tri2, glm::vec3 tri3) {
-        // Test to see if it is within an infinite prism that the triangle outlines.
-        bool within_tri_prisim = SameSide(point, tri1, tri2, tri3) && SameSide(point, tri2, tri1, tri3)
-            && SameSide(point, tri3, tri1, tri2);
-
-        // If it isn't it will never be on the triangle
-        if (!within_tri_prisim)
-            return false;
-
-        // Calulate Triangle's Normal
-        glm::vec3 n = GenTriNormal(tri1, tri2, tri3);
+    unsigned int GetIndex(size_t i) const {
+        size_t m = MeshOf(IndexStart, i);
+        return (unsigned int)VertexStart[m] + (*Meshes)[m].Indices[i - IndexStart[m]];
+    }
 
-        // Project the point onto this normal
-        glm::vec3 proj = glm::proj(point, glm::normalize(n));
+private:
+    const std::vector<ObjMesh>* Meshes;
+    std::vector<size_t> VertexStart;
+    std::vector<size_t> IndexStart;
 
-        // If the distance from the triangle to the point is 0
-        //	it lies on the triangle
-        if (glm::length(proj) == 0)
-            return true;
-        else
-            return false;
+    // Find the mesh whose [start, next start) range holds i
+    static size_t MeshOf(const std::vector<size_t>& starts, size_t i) {
+        return std::upper_bound(starts.begin(), starts.end(), i) - starts.begin() - 1;
     }
+};
+
+// Position/texcoord/normal indices of one face corner as written in the file (0 = not given)
+struct ObjCorner {
+    int Position;
+    int TexCoord;
+    int Normal;
+};
 
+namespace algorithm {
     // Split a String into a string array at a given token
     inline void split(const std::string &in,
         std::vector<std::string> &out,
@@ -182,221 +190,376 @@ namespace algorithm {
             idx--;
         return elements[idx];
     }
-}
 
-class ObjLoader {
-public:
-    // Loaded ObjMesh Objects
-    std::vector<ObjMesh> LoadedObjMeshes;
-    // Loaded Vertex Objects
-    std::vector<Vertex> LoadedVertices;
-    // Loaded Index Positions
-    std::vector<unsigned int> LoadedIndices;
-    // Loaded Material Objects
-    std::vector<Material> LoadedMaterials;
+    // Resolve a 1-based (or negative, relative) .obj index into a 0-based one.
+    // Returns -1 if the index does not refer to an element.
+    inline int resolveIndex(int idx, size_t count) {
+        if (idx < 0)
+            idx = int(count) + idx;
+        else
+            idx--;
+        if (idx < 0 || idx >= int(count))
+            return -1;
+        return idx;
+    }
 
-public:
-    ObjLoader(const std::string& path) {
-        LoadFile(path);
+    // Raw buffer helpers used by the mapped .obj parser.
+    // They work on [p, end) ranges so no per line strings are allocated.
+
+    inline bool isBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
     }
-    ~ObjLoader() {
-        LoadedObjMeshes.clear();
+
+    // Skip spaces and tabs
+    inline const char* skipBlank(const char* p, const char* end) {
+        while (p < end && isBlank(*p))
+            p++;
+        return p;
     }
 
-private:
-    void LoadFile(std::string Path) {
-        std::ifstream file(Path);
+    // Find the end of the current line (the '\n' or end)
+    inline const char* lineEnd(const char* p, const char* end) {
+        if (p >= end)
+            return end;
+        const char* nl = (const char*)memchr(p, '\n', end - p);
+        return nl ? nl : end;
+    }
 
-        if (!file.is_open()) {
-            cout << "Failed to Load File. May have failed to find it or it was not an .obj file.\n";
-            return;
-        }
+    // Find the end of the token starting at p
+    inline const char* tokenEnd(const char* p, const char* end) {
+        while (p < end && !isBlank(*p))
+            p++;
+        return p;
+    }
 
-        LoadedObjMeshes.clear();
-        LoadedVertices.clear();
-        LoadedIndices.clear();
+    // Check if the token [p, tokEnd) equals a keyword
+    inline bool tokenIs(const char* p, const char* tokEnd, const char* keyword) {
+        size_t len = strlen(keyword);
+        return size_t(tokEnd - p) == len && memcmp(p, keyword, len) == 0;
+    }
 
-        std::vector<glm::vec3> Positions;
-        std::vector<glm::vec2> TCoords;
-        std::vector<glm::vec3> Normals;
+    // Get the rest of the line with surrounding blanks trimmed
+    inline std::string tail(const char* p, const char* end) {
+        p = skipBlank(p, end);
+        while (end > p && isBlank(end[-1]))
+            end--;
+        return std::string(p, end);
+    }
 
-        std::vector<Vertex> Vertices;
-        std::vector<unsigned int> Indices;
+    // Parse a signed integer, returns the position after it (p if there was none)
+    inline const char* parseInt(const char* p, const char* end, int& out) {
+        const char* start = p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9')
+            return start;
+        // Saturate instead of overflowing; an index this large never resolves
+        long long value = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (value <= INT_MAX)
+                value = value * 10 + (*p - '0');
+            p++;
+        }
+        if (value > INT_MAX)
+            value = INT_MAX;
+        out = int(negative ? -value : value);
+        return p;
+    }
 
-        std::vector<std::string> ObjMeshMatNames;
+    // Parse a float, returns the position after it (p if there was none).
+    // The result is rounded exactly like strtof. Plain decimal numbers are
+    // converted from an integer mantissa and a power of ten in double,
+    // which is correctly rounded; narrowing that to float can only round
+    // differently when the double lies exactly halfway between two floats,
+    // so those few and anything unusual fall back to strtof.
+    inline const char* parseFloat(const char* p, const char* end, float& out) {
+        static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        const char* start = p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
 
-        bool listening = false;
-        std::string ObjMeshname;
+        unsigned long long mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool any = false;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (mantissa != 0 || *p != '0') {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits++;
+            }
+            p++;
+            any = true;
+        }
+        if (p < end && *p == '.') {
+            p++;
+            while (p < end && *p >= '0' && *p <= '9') {
+                if (mantissa != 0 || *p != '0') {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    digits++;
+                }
+                exponent--;
+                p++;
+                any = true;
+            }
+        }
+        if (any && p < end && (*p == 'e' || *p == 'E')) {
+            int e = 0;
+            const char* q = parseInt(p + 1, end, e);
+            if (q != p + 1) {
+                exponent += e;
+                p = q;
+            }
+        }
 
-        ObjMesh tempObjMesh;
+        if (any && digits <= 15 && exponent >= -22 && exponent <= 22) {
+            double value = (double)mantissa;
+            value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+            // The 29 significand bits a float drops, 0x10000000 = halfway
+            unsigned long long bits;
+            memcpy(&bits, &value, sizeof(bits));
+            if ((bits & 0x1FFFFFFFull) != 0x10000000ull) {
+                out = (float)(negative ? -value : value);
+                return p;
+            }
+        }
 
-        std::string curline;
-        while (std::getline(file, curline)) {
-            if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g" || curline[0] == 'g') {
-                if (!listening) {
-                    listening = true;
+        // Slow path: long mantissas, large exponents, inf/nan
+        char buffer[64];
+        size_t len = 0;
+        const char* q = start;
+        while (q < end && !isBlank(*q) && *q != '/' && *q != '\n' && len < sizeof(buffer) - 1)
+            buffer[len++] = *q++;
+        buffer[len] = '\0';
+        char* parsedEnd;
+        float value = strtof(buffer, &parsedEnd);
+        if (parsedEnd == buffer)
+            return start;
+        out = value;
+        return start + (parsedEnd - buffer);
+    }
+}
 
-                    if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g") {
-                        ObjMeshname = algorithm::tail(curline);
-                    }
-                    else {
-                        ObjMeshname = "unnamed";
-                    }
-                }
-                else {
-                    // Generate the ObjMesh to put into the array
-                    if (!Indices.empty() && !Vertices.empty()) {
-                        // Create ObjMesh
-                        tempObjMesh = ObjMesh(Vertices, Indices);
-                        tempObjMesh.ObjMeshName = ObjMeshname;
+// Number of attributes defined before a line of the file
+struct ObjCounts {
+    size_t Positions;
+    size_t TCoords;
+    size_t Normals;
+};
 
-                        // Insert ObjMesh
-                        LoadedObjMeshes.push_back(tempObjMesh);
+// One face / o / g / usemtl / mtllib line parsed by a worker
+struct ObjRecord {
+    enum Kind { Face, Group, UseMaterial, MaterialLibrary };
+    Kind Type;
+    // First corner for faces, name index for the others
+    unsigned int First;
+    // Number of corners for faces
+    unsigned int Count;
+    // Chunk-local attribute counts at this line, used to resolve face indices in the merge
+    ObjCounts Seen;
+};
 
-                        // Cleanup
-                        Vertices.clear();
-                        Indices.clear();
-                        ObjMeshname.clear();
+// Everything a worker parsed out of one newline aligned range of the file
+struct ObjChunk {
+    std::vector<glm::vec3> Positions;
+    std::vector<glm::vec2> TCoords;
+    std::vector<glm::vec3> Normals;
+    std::vector<ObjCorner> Corners;
+    std::vector<ObjRecord> Records;
+    std::vector<std::string> Names;
+
+    void AddPosition(const glm::vec3& v) { Positions.push_back(v); }
+    void AddTexCoord(const glm::vec2& v) { TCoords.push_back(v); }
+    void AddNormal(const glm::vec3& v) { Normals.push_back(v); }
+
+    void AddFace(const std::vector<ObjCorner>& corners) {
+        ObjRecord record = { ObjRecord::Face, (unsigned int)Corners.size(), (unsigned int)corners.size(), Seen() };
+        Corners.insert(Corners.end(), corners.begin(), corners.end());
+        Records.push_back(record);
+    }
+    void AddGroup(const std::string& name) { AddNamed(ObjRecord::Group, name); }
+    void AddUseMaterial(const std::string& name) { AddNamed(ObjRecord::UseMaterial, name); }
+    void AddMaterialLibrary(const std::string& name) { AddNamed(ObjRecord::MaterialLibrary, name); }
 
-                        ObjMeshname = algorithm::tail(curline);
-                    }
-                    else {
-                        if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g") {
-                            ObjMeshname = algorithm::tail(curline);
-                        }
-                        else {
-                            ObjMeshname = "unnamed";
-                        }
-                    }
-                }
-            }
-            // Generate a Vertex Position
-            if (algorithm::firstToken(curline) == "v") {
-                std::vector<std::string> spos;
-                glm::vec3 vpos;
-                algorithm::split(algorithm::tail(curline), spos, " ");
+private:
+    ObjCounts Seen() const {
+        ObjCounts counts = { Positions.size(), TCoords.size(), Normals.size() };
+        return counts;
+    }
+    void AddNamed(ObjRecord::Kind type, const std::string& name) {
+        ObjRecord record = { type, (unsigned int)Names.size(), 0, Seen() };
+        Names.push_back(name);
+        Records.push_back(record);
+    }
+};
 
-                vpos.x = std::stof(spos[0]);
-                vpos.y = std::stof(spos[1]);
-                vpos.z = std::stof(spos[2]);
+// Open addressing hash from a resolved (position, texcoord, normal) index
+// triple to the vertex it was welded into, for the ObjMesh being built.
+class ObjVertexWelder {
+public:
+    ObjVertexWelder() : used(0) {
+        reset(64);
+    }
 
-                Positions.push_back(vpos);
-            }
-            // Generate a Vertex Texture Coordinate
-            if (algorithm::firstToken(curline) == "vt") {
-                std::vector<std::string> stex;
-                glm::vec2 vtex;
-                algorithm::split(algorithm::tail(curline), stex, " ");
+    // Forget every vertex, called when an ObjMesh is finished
+    void clear() {
+        if (used == 0)
+            return;
+        // don't keep the table of a huge mesh around for the next small one
+        reset(64);
+    }
 
-                vtex.x = std::stof(stex[0]);
-                vtex.y = std::stof(stex[1]);
+    // Return the vertex welded for key, or remember newIndex for it
+    unsigned int weld(const ObjCorner& key, unsigned int newIndex) {
+        if ((used + 1) * 2 > slots.size())
+            grow();
+        size_t mask = slots.size() - 1;
+        size_t i = hash(key) & mask;
+        while (slots[i].Index != Empty) {
+            const ObjCorner& k = slots[i].Key;
+            if (k.Position == key.Position && k.TexCoord == key.TexCoord && k.Normal == key.Normal)
+                return slots[i].Index;
+            i = (i + 1) & mask;
+        }
+        slots[i].Key = key;
+        slots[i].Index = newIndex;
+        used++;
+        return newIndex;
+    }
 
-                TCoords.push_back(vtex);
-            }
-            // Generate a Vertex Normal;
-            if (algorithm::firstToken(curline) == "vn") {
-                std::vector<std::string> snor;
-                glm::vec3 vnor;
-                algorithm::split(algorithm::tail(curline), snor, " ");
+private:
+    static const unsigned int Empty = 0xFFFFFFFFu;
+
+    struct Slot {
+        ObjCorner Key;
+        unsigned int Index;
+    };
+    std::vector<Slot> slots;
+    size_t used;
+
+    static size_t hash(const ObjCorner& key) {
+        size_t h = (size_t)(unsigned int)key.Position * 0x9E3779B1u;
+        h ^= (size_t)(unsigned int)key.TexCoord * 0x85EBCA77u + (h << 6) + (h >> 2);
+        h ^= (size_t)(unsigned int)key.Normal * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+        return h ^ (h >> 15);
+    }
 
-                vnor.x = std::stof(snor[0]);
-                vnor.y = std::stof(snor[1]);
-                vnor.z = std::stof(snor[2]);
+    void reset(size_t capacity) {
+        Slot empty = { { 0, 0, 0 }, Empty };
+        slots.assign(capacity, empty);
+        used = 0;
+    }
 
-                Normals.push_back(vnor);
-            }
-            // Generate a Face (vertices & indices)
-            if (algorithm::firstToken(curline) == "f") {
-                // Generate the vertices
-                std::vector<Vertex> vVerts;
-                GenVerticesFromRawOBJ(vVerts, Positions, TCoords, Normals, curline);
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+        reset(old.size() * 2);
+        for (size_t i = 0; i < old.size(); i++)
+            if (old[i].Index != Empty)
+                weld(old[i].Key, old[i].Index);
+    }
+};
 
-                // Add Vertices
-                for (int i = 0; i < int(vVerts.size()); i++) {
-                    Vertices.push_back(vVerts[i]);
+class ObjLoader {
+public:
+    // Loaded ObjMesh Objects
+    std::vector<ObjMesh> LoadedObjMeshes;
+    // Loaded Material Objects
+    std::vector<Material> LoadedMaterials;
+    // Paths of the material libraries the file refers to
+    std::vector<std::string> MaterialLibraries;
 
-                    LoadedVertices.push_back(vVerts[i]);
-                }
+    // Files smaller than this are always parsed on the calling thread
+    static const size_t ParallelThreshold = 8 << 20;
 
-                std::vector<unsigned int> iIndices;
+    // Called for every material as soon as its .mtl file is parsed,
+    // long before the geometry is done (e.g. to start decoding textures)
+    typedef std::function<void(const Material&)> MaterialCallback;
 
-                VertexTriangluation(iIndices, vVerts);
+public:
+    // threadCount = 0 picks the number of hardware threads, 1 forces the serial loader.
+    // The parallel loader produces exactly the same output as the serial one.
+    ObjLoader(const std::string& path, unsigned int threadCount = 0, MaterialCallback onMaterial = MaterialCallback())
+        : MaterialLoaded(onMaterial) {
+        LoadFile(path, threadCount);
+    }
+    ~ObjLoader() {
+        LoadedObjMeshes.clear();
+    }
 
-                // Add Indices
-                for (int i = 0; i < int(iIndices.size()); i++) {
-                    unsigned int indnum = (unsigned int)((Vertices.size()) - vVerts.size()) + iIndices[i];
-                    Indices.push_back(indnum);
+    // All loaded vertices & indices as one array, without copying them
+    ObjGlobalView GlobalView() const {
+        return ObjGlobalView(LoadedObjMeshes);
+    }
 
-                    indnum = (unsigned int)((LoadedVertices.size()) - vVerts.size()) + iIndices[i];
-                    LoadedIndices.push_back(indnum);
+private:
+    // Raw attributes referenced by the faces
+    std::vector<glm::vec3> Positions;
+    std::vector<glm::vec2> TCoords;
+    std::vector<glm::vec3> Normals;
 
-                }
-            }
-            // Get ObjMesh Material Name
-            if (algorithm::firstToken(curline) == "usemtl") {
-                ObjMeshMatNames.push_back(algorithm::tail(curline));
-
-                // Create new ObjMesh, if Material changes within a group
-                if (!Indices.empty() && !Vertices.empty()) {
-                    // Create ObjMesh
-                    tempObjMesh = ObjMesh(Vertices, Indices);
-                    tempObjMesh.ObjMeshName = ObjMeshname;
-                    int i = 2;
-                    while (1) {
-                        tempObjMesh.ObjMeshName = ObjMeshname + "_" + std::to_string(i);
-
-                        for (auto &m : LoadedObjMeshes)
-                            if (m.ObjMeshName == tempObjMesh.ObjMeshName)
-                                continue;
-                        break;
-                    }
+    // Vertices & indices of the ObjMesh being built
+    std::vector<Vertex> Vertices;
+    std::vector<unsigned int> Indices;
 
-                    // Insert ObjMesh
-                    LoadedObjMeshes.push_back(tempObjMesh);
+    std::vector<std::string> ObjMeshMatNames;
 
-                    // Cleanup
-                    Vertices.clear();
-                    Indices.clear();
-                }
+    bool listening;
+    std::string ObjMeshname;
+    std::string ObjDirectory;
 
-            }
-            // Load Materials
-            if (algorithm::firstToken(curline) == "mtllib") {
-                // Generate LoadedMaterial
+    MaterialCallback MaterialLoaded;
 
-                // Generate a path to the material file
-                std::vector<std::string> temp;
-                algorithm::split(Path, temp, "/");
+    // Shares vertices between faces of the current ObjMesh
+    ObjVertexWelder Welder;
 
-                std::string pathtomat = "";
+    // Splits faces into triangles, keeps its scratch buffers between faces
+    PolygonTriangulator FaceTriangulator;
 
-                if (temp.size() != 1) {
-                    for (int i = 0; i < temp.size() - 1; i++) {
-                        pathtomat += temp[i] + "/";
-                    }
-                }
+    // Scratch buffers reused for every face
+    std::vector<Vertex> FaceVertices;
+    std::vector<ObjCorner> FaceKeys;
+    std::vector<unsigned int> FaceIndices;
+    std::vector<unsigned int> FaceWelded;
 
-                pathtomat += algorithm::tail(curline);
+    void LoadFile(std::string Path, unsigned int threadCount) {
+        MappedFile file(Path);
 
-                // Load Materials
-                LoadMaterials(pathtomat);
-            }
+        if (!file.isOpen()) {
+            cout << "Failed to Load File. May have failed to find it or it was not an .obj file.\n";
+            return;
         }
 
-        // Deal with last ObjMesh
-        if (!Indices.empty() && !Vertices.empty()) {
-            // Create ObjMesh
-            tempObjMesh = ObjMesh(Vertices, Indices);
-            tempObjMesh.ObjMeshName = ObjMeshname;
+        LoadedObjMeshes.clear();
 
-            // Insert ObjMesh
-            LoadedObjMeshes.push_back(tempObjMesh);
-        }
+        listening = false;
+        ObjMeshname.clear();
+        Welder.clear();
+        ObjDirectory = Path.substr(0, Path.find_last_of('/') + 1);
+
+        if (threadCount == 0)
+            threadCount = ThreadPool::hardwareThreads();
+        if (threadCount > 1 && file.size() >= ParallelThreshold)
+            ParseParallel(file.data(), file.end(), threadCount);
+        else
+            ParseRange(file.data(), file.end(), *this);
+
+        // Deal with last ObjMesh
+        if (!Indices.empty() && !Vertices.empty())
+            FlushObjMesh(ObjMeshname);
 
         file.close();
 
         // Set Materials for each ObjMesh
-        for (int i = 0; i < ObjMeshMatNames.size(); i++) {
+        for (int i = 0; i < ObjMeshMatNames.size() && i < LoadedObjMeshes.size(); i++) {
             std::string matname = ObjMeshMatNames[i];
 
             // Find corresponding material name in loaded materials
@@ -409,259 +572,334 @@ private:
             }
         }
 
-        if (LoadedObjMeshes.empty() && LoadedVertices.empty() && LoadedIndices.empty()) {
+        // Release the parsing state
+        std::vector<glm::vec3>().swap(Positions);
+        std::vector<glm::vec2>().swap(TCoords);
+        std::vector<glm::vec3>().swap(Normals);
+        std::vector<Vertex>().swap(Vertices);
+        std::vector<unsigned int>().swap(Indices);
+
+        if (LoadedObjMeshes.empty()) {
             cout << "Failed to Load File. May have failed to find it or it was not an .obj file.\n";
             return;
         }
     }
 
-    // Generate vertices from a list of positions, 
-    //	tcoords, normals and a face line
-    void GenVerticesFromRawOBJ(std::vector<Vertex>& oVerts,
-        const std::vector<glm::vec3>& iPositions,
-        const std::vector<glm::vec2>& iTCoords,
-        const std::vector<glm::vec3>& iNormals,
-        std::string icurline) {
-        std::vector<std::string> sface, svert;
-        Vertex vVert;
-        algorithm::split(algorithm::tail(icurline), sface, " ");
-
-        bool noNormal = false;
-
-        // For every given vertex do this
-        for (int i = 0; i < int(sface.size()); i++) {
-            // See What type the vertex is.
-            int vtype;
-
-            algorithm::split(sface[i], svert, "/");
+    // Split the file at newlines, tokenize the pieces on a worker pool and
+    // then replay their records in file order, so that index resolution and
+    // o/g/usemtl boundaries see exactly what the serial loader would see.
+    void ParseParallel(const char* begin, const char* end, unsigned int threadCount) {
+        size_t chunkCount = threadCount * 4;
+        size_t chunkSize = (end - begin) / chunkCount + 1;
+
+        std::vector<const char*> bounds;
+        bounds.push_back(begin);
+        while (bounds.back() < end) {
+            const char* next = bounds.back() + chunkSize;
+            next = next >= end ? end : algorithm::lineEnd(next, end);
+            bounds.push_back(next < end ? next + 1 : end);
+        }
 
-            // Check for just position - v1
-            if (svert.size() == 1) {
-                // Only position
-                vtype = 1;
+        std::vector<ObjChunk> chunks(bounds.size() - 1);
+        {
+            ThreadPool pool(threadCount);
+            std::vector<std::future<void> > pending;
+            for (size_t i = 0; i < chunks.size(); i++) {
+                ObjChunk* chunk = &chunks[i];
+                const char* from = bounds[i];
+                const char* to = bounds[i + 1];
+                pending.push_back(pool.enqueue([chunk, from, to]() { ParseRange(from, to, *chunk); }));
             }
-
-            // Check for position & texture - v1/vt1
-            if (svert.size() == 2) {
-                // Position & Texture
-                vtype = 2;
+            // Load material libraries as each chunk finishes, so the
+            // material callback runs while later chunks are still parsed
+            for (size_t i = 0; i < pending.size(); i++) {
+                pending[i].get();
+                for (size_t r = 0; r < chunks[i].Records.size(); r++) {
+                    const ObjRecord& record = chunks[i].Records[r];
+                    if (record.Type == ObjRecord::MaterialLibrary)
+                        AddMaterialLibrary(chunks[i].Names[record.First]);
+                }
             }
+        }
 
-            // Check for Position, Texture and Normal - v1/vt1/vn1
-            // or if Position and Normal - v1//vn1
-            if (svert.size() == 3) {
-                if (svert[1] != "") {
-                    // Position, Texture, and Normal
-                    vtype = 4;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            ObjChunk& chunk = chunks[i];
+            ObjCounts base = { Positions.size(), TCoords.size(), Normals.size() };
+            Positions.insert(Positions.end(), chunk.Positions.begin(), chunk.Positions.end());
+            TCoords.insert(TCoords.end(), chunk.TCoords.begin(), chunk.TCoords.end());
+            Normals.insert(Normals.end(), chunk.Normals.begin(), chunk.Normals.end());
+
+            for (size_t r = 0; r < chunk.Records.size(); r++) {
+                const ObjRecord& record = chunk.Records[r];
+                switch (record.Type) {
+                case ObjRecord::Face: {
+                    ObjCounts seen = { base.Positions + record.Seen.Positions, base.TCoords + record.Seen.TCoords, base.Normals + record.Seen.Normals };
+                    BuildFace(&chunk.Corners[record.First], record.Count, seen);
+                    break;
                 }
-                else {
-                    // Position & Normal
-                    vtype = 3;
+                case ObjRecord::Group:
+                    AddGroup(chunk.Names[record.First]);
+                    break;
+                case ObjRecord::UseMaterial:
+                    AddUseMaterial(chunk.Names[record.First]);
+                    break;
+                case ObjRecord::MaterialLibrary:
+                    // Already loaded when the chunk finished
+                    break;
                 }
             }
 
-            // Calculate and store the vertex
-            switch (vtype) {
-            case 1: // P
-            {
-                vVert.Position = algorithm::getElement(iPositions, svert[0]);
-                vVert.TexCoords = glm::vec2(0, 0);
-                noNormal = true;
-                oVerts.push_back(vVert);
-                break;
-            }
-            case 2: // P/T
-            {
-                vVert.Position = algorithm::getElement(iPositions, svert[0]);
-                vVert.TexCoords = algorithm::getElement(iTCoords, svert[1]);
-                noNormal = true;
-                oVerts.push_back(vVert);
-                break;
-            }
-            case 3: // P//N
-            {
-                vVert.Position = algorithm::getElement(iPositions, svert[0]);
-                vVert.TexCoords = glm::vec2(0, 0);
-                vVert.Normal = algorithm::getElement(iNormals, svert[2]);
-                oVerts.push_back(vVert);
+            // Drop the chunk as soon as it is merged
+            chunk = ObjChunk();
+        }
+    }
+
+    // Tokenize [p, end) one line at a time, straight out of the buffer.
+    // Sink is either the loader itself (serial) or an ObjChunk (parallel).
+    template <class Sink>
+    static void ParseRange(const char* p, const char* end, Sink& sink) {
+        std::vector<ObjCorner> corners;
+        while (p < end) {
+            p = algorithm::skipBlank(p, end);
+            const char* eol = algorithm::lineEnd(p, end);
+            const char* keyEnd = algorithm::tokenEnd(p, eol);
+
+            switch (keyEnd - p) {
+            case 1:
+                // Generate a Vertex Position
+                if (*p == 'v') {
+                    glm::vec3 vpos(0.0f);
+                    ParseFloats(keyEnd, eol, &vpos.x, 3);
+                    sink.AddPosition(vpos);
+                }
+                // Generate a Face (vertices & indices)
+                else if (*p == 'f') {
+                    ParseFace(keyEnd, eol, corners);
+                    sink.AddFace(corners);
+                }
+                else if (*p == 'o' || *p == 'g') {
+                    sink.AddGroup(algorithm::tail(keyEnd, eol));
+                }
                 break;
-            }
-            case 4: // P/T/N
-            {
-                vVert.Position = algorithm::getElement(iPositions, svert[0]);
-                vVert.TexCoords = algorithm::getElement(iTCoords, svert[1]);
-                vVert.Normal = algorithm::getElement(iNormals, svert[2]);
-                oVerts.push_back(vVert);
+            case 2:
+                // Generate a Vertex Texture Coordinate
+                if (p[0] == 'v' && p[1] == 't') {
+                    glm::vec2 vtex(0.0f);
+                    ParseFloats(keyEnd, eol, &vtex.x, 2);
+                    sink.AddTexCoord(vtex);
+                }
+                // Generate a Vertex Normal
+                else if (p[0] == 'v' && p[1] == 'n') {
+                    glm::vec3 vnor(0.0f);
+                    ParseFloats(keyEnd, eol, &vnor.x, 3);
+                    sink.AddNormal(vnor);
+                }
                 break;
-            }
-            default:
-            {
+            case 6:
+                // Get ObjMesh Material Name
+                if (algorithm::tokenIs(p, keyEnd, "usemtl")) {
+                    sink.AddUseMaterial(algorithm::tail(keyEnd, eol));
+                }
+                // Load Materials
+                else if (algorithm::tokenIs(p, keyEnd, "mtllib")) {
+                    sink.AddMaterialLibrary(algorithm::tail(keyEnd, eol));
+                }
                 break;
             }
-            }
+
+            p = eol + 1;
         }
+    }
 
-        // take care of missing normals
-        // these may not be truly acurate but it is the 
-        // best they get for not compiling a ObjMesh with normals	
-        if (noNormal) {
-            glm::vec3 A = oVerts[0].Position - oVerts[1].Position;
-            glm::vec3 B = oVerts[2].Position - oVerts[1].Position;
+    // Read up to count floats from a line, missing ones keep their value
+    static void ParseFloats(const char* p, const char* eol, float* out, int count) {
+        for (int i = 0; i < count; i++) {
+            p = algorithm::skipBlank(p, eol);
+            const char* next = algorithm::parseFloat(p, eol, out[i]);
+            if (next == p)
+                break;
+            p = next;
+        }
+    }
 
-            glm::vec3 normal = glm::cross(A, B);
+    // Parse the corners of a face line (v, v/vt, v//vn, v/vt/vn)
+    static void ParseFace(const char* p, const char* eol, std::vector<ObjCorner>& corners) {
+        corners.clear();
+        while (true) {
+            p = algorithm::skipBlank(p, eol);
+            if (p >= eol)
+                break;
 
-            for (int i = 0; i < int(oVerts.size()); i++) {
-                oVerts[i].Normal = normal;
+            ObjCorner corner = { 0, 0, 0 };
+            const char* next = algorithm::parseInt(p, eol, corner.Position);
+            if (next < eol && *next == '/') {
+                next = algorithm::parseInt(next + 1, eol, corner.TexCoord);
+                if (next < eol && *next == '/')
+                    next = algorithm::parseInt(next + 1, eol, corner.Normal);
             }
+            if (corner.Position != 0)
+                corners.push_back(corner);
+            p = algorithm::tokenEnd(next, eol);
         }
     }
 
-    // Triangulate a list of vertices into a face by printing
-    //	inducies corresponding with triangles within it
-    void VertexTriangluation(std::vector<unsigned int>& oIndices,
-        const std::vector<Vertex>& iVerts) {
-        // If there are 2 or less verts,
-        // no triangle can be created,
-        // so exit
-        if (iVerts.size() < 3) {
-            return;
+    // Serial sink: lines are applied as soon as they are tokenized
+    void AddPosition(const glm::vec3& v) { Positions.push_back(v); }
+    void AddTexCoord(const glm::vec2& v) { TCoords.push_back(v); }
+    void AddNormal(const glm::vec3& v) { Normals.push_back(v); }
+
+    void AddFace(const std::vector<ObjCorner>& corners) {
+        ObjCounts seen = { Positions.size(), TCoords.size(), Normals.size() };
+        BuildFace(corners.data(), corners.size(), seen);
+    }
+
+    // Handle an o/g line
+    void AddGroup(const std::string& name) {
+        if (!listening) {
+            listening = true;
         }
-        // If it is a triangle no need to calculate it
-        if (iVerts.size() == 3) {
-            oIndices.push_back(0);
-            oIndices.push_back(1);
-            oIndices.push_back(2);
-            return;
+        // Generate the ObjMesh to put into the array
+        else if (!Indices.empty() && !Vertices.empty()) {
+            FlushObjMesh(ObjMeshname);
         }
+        ObjMeshname = name;
+    }
 
-        // Create a list of vertices
-        std::vector<Vertex> tVerts = iVerts;
+    // Handle a usemtl line
+    void AddUseMaterial(const std::string& name) {
+        ObjMeshMatNames.push_back(name);
 
-        while (true) {
-            // For every vertex
-            for (int i = 0; i < int(tVerts.size()); i++) {
-                // pPrev = the previous vertex in the list
-                Vertex pPrev;
-                if (i == 0) {
-                    pPrev = tVerts[tVerts.size() - 1];
-                }
-                else {
-                    pPrev = tVerts[i - 1];
-                }
+        // Create new ObjMesh, if Material changes within a group
+        if (!Indices.empty() && !Vertices.empty())
+            FlushObjMesh(ObjMeshname + "_2");
+    }
 
-                // pCur = the current vertex;
-                Vertex pCur = tVerts[i];
+    // Handle a mtllib line
+    void AddMaterialLibrary(const std::string& name) {
+        size_t first = LoadedMaterials.size();
+        MaterialLibraries.push_back(ObjDirectory + name);
+        LoadMaterials(MaterialLibraries.back());
+        if (MaterialLoaded)
+            for (size_t i = first; i < LoadedMaterials.size(); i++)
+                MaterialLoaded(LoadedMaterials[i]);
+    }
 
-                // pNext = the next vertex in the list
-                Vertex pNext;
-                if (i == tVerts.size() - 1) {
-                    pNext = tVerts[0];
-                }
-                else {
-                    pNext = tVerts[i + 1];
-                }
+    // Turn the corners of a face into triangle indices of the current ObjMesh.
+    // Corners with the same position/texcoord/normal indices share one vertex;
+    // faces that get a generated (flat) normal keep their own vertices.
+    void BuildFace(const ObjCorner* corners, size_t count, const ObjCounts& seen) {
+        FaceVertices.clear();
+        FaceKeys.clear();
+        if (!GenVerticesFromRawOBJ(FaceVertices, FaceKeys, corners, count, seen))
+            return;
 
-                // Check to see if there are only 3 verts left
-                // if so this is the last triangle
-                if (tVerts.size() == 3) {
-                    // Create a triangle from pCur, pPrev, pNext
-                    for (int j = 0; j < int(tVerts.size()); j++) {
-                        if (iVerts[j].Position == pCur.Position)
-                            oIndices.push_back(j);
-                        if (iVerts[j].Position == pPrev.Position)
-                            oIndices.push_back(j);
-                        if (iVerts[j].Position == pNext.Position)
-                            oIndices.push_back(j);
-                    }
+        FaceIndices.clear();
+        VertexTriangluation(FaceIndices, FaceVertices);
+        if (FaceIndices.empty())
+            return;
 
-                    tVerts.clear();
-                    break;
-                }
-                if (tVerts.size() == 4) {
-                    // Create a triangle from pCur, pPrev, pNext
-                    for (int j = 0; j < int(iVerts.size()); j++) {
-                        if (iVerts[j].Position == pCur.Position)
-                            oIndices.push_back(j);
-                        if (iVerts[j].Position == pPrev.Position)
-                            oIndices.push_back(j);
-                        if (iVerts[j].Position == pNext.Position)
-                            oIndices.push_back(j);
-                    }
+        bool weld = true;
+        for (int i = 0; i < int(FaceKeys.size()); i++)
+            if (FaceKeys[i].Normal < 0)
+                weld = false;
+
+        // Add Vertices
+        FaceWelded.resize(FaceVertices.size());
+        for (int i = 0; i < int(FaceVertices.size()); i++) {
+            unsigned int index = (unsigned int)Vertices.size();
+            if (weld)
+                index = Welder.weld(FaceKeys[i], index);
+            if (index == Vertices.size())
+                Vertices.push_back(FaceVertices[i]);
+            FaceWelded[i] = index;
+        }
 
-                    glm::vec3 tempVec;
-                    for (int j = 0; j < int(tVerts.size()); j++) {
-                        if (tVerts[j].Position != pCur.Position
-                            && tVerts[j].Position != pPrev.Position
-                            && tVerts[j].Position != pNext.Position) {
-                            tempVec = tVerts[j].Position;
-                            break;
-                        }
-                    }
+        // Add Indices
+        for (int i = 0; i < int(FaceIndices.size()); i++) {
+            Indices.push_back(FaceWelded[FaceIndices[i]]);
+        }
+    }
 
-                    // Create a triangle from pCur, pPrev, pNext
-                    for (int j = 0; j < int(iVerts.size()); j++) {
-                        if (iVerts[j].Position == pPrev.Position)
-                            oIndices.push_back(j);
-                        if (iVerts[j].Position == pNext.Position)
-                            oIndices.push_back(j);
-                        if (iVerts[j].Position == tempVec)
-                            oIndices.push_back(j);
-                    }
+    // Move the current vertices & indices into a new ObjMesh
+    void FlushObjMesh(const std::string& name) {
+        // Insert ObjMesh
+        LoadedObjMeshes.push_back(ObjMesh(std::move(Vertices), std::move(Indices)));
+        LoadedObjMeshes.back().ObjMeshName = name;
 
-                    tVerts.clear();
-                    break;
-                }
+        // Cleanup
+        Vertices.clear();
+        Indices.clear();
+        Welder.clear();
+    }
 
-                // If Vertex is not an interior vertex
-                float angle = glm::degrees(glm::angle(glm::normalize(pPrev.Position - pCur.Position), glm::normalize(pNext.Position - pCur.Position)));
-                if (angle <= 0 && angle >= 180)
-                    continue;
+    // Generate vertices from the corners of a face. Only the first
+    //	seen positions/tcoords/normals may be referenced, as those
+    //	are the ones defined above the face line.
+    // oKeys receives the 0-based indices of every corner (-1 = not given).
+    // Returns false if a corner refers to a missing element.
+    bool GenVerticesFromRawOBJ(std::vector<Vertex>& oVerts,
+        std::vector<ObjCorner>& oKeys,
+        const ObjCorner* iCorners, size_t iCount,
+        const ObjCounts& seen) {
+        bool noNormal = false;
 
-                // If any vertices are within this triangle
-                bool inTri = false;
-                for (int j = 0; j < int(iVerts.size()); j++) {
-                    if (algorithm::inTriangle(iVerts[j].Position, pPrev.Position, pCur.Position, pNext.Position)
-                        && iVerts[j].Position != pPrev.Position
-                        && iVerts[j].Position != pCur.Position
-                        && iVerts[j].Position != pNext.Position) {
-                        inTri = true;
-                        break;
-                    }
-                }
-                if (inTri)
-                    continue;
+        // For every given vertex do this
+        for (int i = 0; i < int(iCount); i++) {
+            const ObjCorner& corner = iCorners[i];
+            ObjCorner key = { -1, -1, -1 };
+            Vertex vVert;
+
+            int p = algorithm::resolveIndex(corner.Position, seen.Positions);
+            if (p < 0)
+                return false;
+            vVert.Position = Positions[p];
+            key.Position = p;
+
+            vVert.TexCoords = glm::vec2(0, 0);
+            if (corner.TexCoord != 0) {
+                int t = algorithm::resolveIndex(corner.TexCoord, seen.TCoords);
+                if (t < 0)
+                    return false;
+                vVert.TexCoords = TCoords[t];
+                key.TexCoord = t;
+            }
 
-                // Create a triangle from pCur, pPrev, pNext
-                for (int j = 0; j < int(iVerts.size()); j++) {
-                    if (iVerts[j].Position == pCur.Position)
-                        oIndices.push_back(j);
-                    if (iVerts[j].Position == pPrev.Position)
-                        oIndices.push_back(j);
-                    if (iVerts[j].Position == pNext.Position)
-                        oIndices.push_back(j);
-                }
+            if (corner.Normal != 0) {
+                int n = algorithm::resolveIndex(corner.Normal, seen.Normals);
+                if (n < 0)
+                    return false;
+                vVert.Normal = Normals[n];
+                key.Normal = n;
+            }
+            else {
+                noNormal = true;
+            }
 
-                // Delete pCur from the list
-                for (int j = 0; j < int(tVerts.size()); j++) {
-                    if (tVerts[j].Position == pCur.Position) {
-                        tVerts.erase(tVerts.begin() + j);
-                        break;
-                    }
-                }
+            oVerts.push_back(vVert);
+            oKeys.push_back(key);
+        }
 
-                // reset i to the start
-                // -1 since loop will add 1 to it
-                i = -1;
-            }
+        // take care of missing normals
+        // these may not be truly acurate but it is the 
+        // best they get for not compiling a ObjMesh with normals	
+        if (noNormal && oVerts.size() >= 3) {
+            glm::vec3 A = oVerts[0].Position - oVerts[1].Position;
+            glm::vec3 B = oVerts[2].Position - oVerts[1].Position;
 
-            // if no triangles were created
-            if (oIndices.size() == 0)
-                break;
+            glm::vec3 normal = glm::cross(A, B);
 
-            // if no more vertices
-            if (tVerts.size() == 0)
-                break;
+            for (int i = 0; i < int(oVerts.size()); i++) {
+                oVerts[i].Normal = normal;
+            }
         }
+        return true;
+    }
+
+    // Triangulate a list of vertices into a face by printing
+    //	inducies corresponding with triangles within it
+    void VertexTriangluation(std::vector<unsigned int>& oIndices,
+        const std::vector<Vertex>& iVerts) {
+        FaceTriangulator.triangulate(iVerts, oIndices);
     }
 
     // Load Materials from .mtl file
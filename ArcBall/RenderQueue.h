@@ -0,0 +1,249 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Mesh.h"
+#include "Shader.h"
+
+#include <vector>
+#include <algorithm>
+
+// GL state changes made by one RenderQueue::flush
+struct RenderStats {
+    unsigned int meshes;
+    // meshes left out because they were outside the view
+    unsigned int culled;
+    // at the levels of detail they were submitted with
+    unsigned int triangles;
+    // GL draw calls; meshes sharing a VAO and textures are merged into one
+    unsigned int draws;
+    unsigned int programChanges;
+    unsigned int textureUnitChanges;
+    unsigned int textureBinds;
+    unsigned int vertexArrayBinds;
+    // uniforms set for a different vertex format or quantization box
+    unsigned int vertexDecodeChanges;
+    // what drawing every mesh on its own (Mesh::Draw) would have cost
+    unsigned int unsortedStateChanges;
+
+    unsigned int stateChanges() const {
+        return programChanges + textureUnitChanges + textureBinds + vertexArrayBinds + vertexDecodeChanges;
+    }
+};
+
+// Collects the draws of a frame, sorts them by program, then texture set,
+// vertex decode, VAO and index type, and submits them while skipping every
+// bind that would not change the GL state. Runs of meshes in the same VAO (a
+// MeshArena) with the same textures and index type become a single
+// glMultiDrawElementsBaseVertex. Nothing is allocated once the item array has
+// grown to the number of meshes drawn per frame.
+class RenderQueue {
+public:
+    // units above this are bound without tracking
+    static const int TrackedUnits = 32;
+
+    RenderQueue() {
+        clear();
+    }
+
+    void clear() {
+        items.clear();
+        counters = RenderStats();
+    }
+
+    // A mesh is drawn with one program per flush (its texture units are cached
+    // per program), at one of its levels of detail
+    void submit(const Shader &shader, const Mesh &mesh, size_t level = 0) {
+        if (!mesh.isUploaded())
+            return;
+        Item item;
+        item.program = shader.ID;
+        item.shader = &shader;
+        item.mesh = &mesh;
+        item.units = &mesh.textureUnitsFor(shader);
+        item.range = mesh.lod(level);
+        items.push_back(item);
+    }
+
+    // meshes that were not submitted because they cannot be seen
+    void cull(size_t count = 1) {
+        counters.culled += (unsigned int)count;
+    }
+
+    void flush() {
+        std::sort(items.begin(), items.end(), drawsBefore);
+
+        // nothing is known about the state left by the code outside the queue
+        unsigned int program = 0;
+        bool programKnown = false;
+        unsigned int vao = 0;
+        bool vaoKnown = false;
+        const Mesh* decoded = NULL;
+        int activeUnit = -1;
+        unsigned int bound[TrackedUnits];
+        std::fill(bound, bound + TrackedUnits, (unsigned int)-1);
+
+        for (size_t i = 0; i < items.size();) {
+            const Item& item = items[i];
+            const Mesh& mesh = *item.mesh;
+            const std::vector<int>& units = *item.units;
+
+            if (!programKnown || program != item.program) {
+                glUseProgram(item.program);
+                program = item.program;
+                programKnown = true;
+                counters.programChanges++;
+                decoded = NULL;
+            }
+
+            if (!decoded || !decoded->sameVertexDecode(mesh)) {
+                mesh.applyVertexDecode(*item.shader);
+                decoded = &mesh;
+                counters.vertexDecodeChanges++;
+            }
+
+            for (size_t t = 0; t < units.size(); t++) {
+                int unit = units[t];
+                if (unit < 0)
+                    continue;
+                unsigned int id = mesh.textures[t].id;
+                counters.unsortedStateChanges += 2;
+                if (unit < TrackedUnits && bound[unit] == id)
+                    continue;
+                if (activeUnit != unit) {
+                    glActiveTexture(GL_TEXTURE0 + unit);
+                    activeUnit = unit;
+                    counters.textureUnitChanges++;
+                }
+                glBindTexture(GL_TEXTURE_2D, id);
+                if (unit < TrackedUnits)
+                    bound[unit] = id;
+                counters.textureBinds++;
+            }
+
+            if (!vaoKnown || vao != mesh.VAO) {
+                glBindVertexArray(mesh.VAO);
+                vao = mesh.VAO;
+                vaoKnown = true;
+                counters.vertexArrayBinds++;
+            }
+
+            // the following items that need no state change at all
+            size_t end = i + 1;
+            while (end < items.size() && items[end].program == item.program && items[end].mesh->VAO == mesh.VAO
+                && items[end].mesh->indexType() == mesh.indexType()
+                && items[end].mesh->sameVertexDecode(mesh) && compareTextures(items[end], item) == 0)
+                end++;
+
+            if (end - i == 1) {
+                glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)item.range.indexCount, mesh.indexType(),
+                    (void*)mesh.lodOffset(item.range), mesh.baseVertex);
+            }
+            else {
+                counts.clear();
+                offsets.clear();
+                baseVertices.clear();
+                for (size_t k = i; k < end; k++) {
+                    counts.push_back((GLsizei)items[k].range.indexCount);
+                    offsets.push_back((const void*)items[k].mesh->lodOffset(items[k].range));
+                    baseVertices.push_back(items[k].mesh->baseVertex);
+                }
+                glMultiDrawElementsBaseVertex(GL_TRIANGLES, &counts[0], mesh.indexType(),
+                    (const void* const*)&offsets[0], (GLsizei)counts.size(), &baseVertices[0]);
+            }
+            counters.draws++;
+
+            for (size_t k = i; k < end; k++) {
+                // Mesh::Draw sets its decode uniforms, binds and unbinds its
+                // VAO and resets the active unit
+                counters.unsortedStateChanges += 4;
+                counters.triangles += items[k].range.indexCount / 3;
+                if (k > i)
+                    for (size_t t = 0; t < items[k].units->size(); t++)
+                        if ((*items[k].units)[t] >= 0)
+                            counters.unsortedStateChanges += 2;
+            }
+            counters.meshes += (unsigned int)(end - i);
+            i = end;
+        }
+
+        if (vaoKnown && vao != 0) {
+            glBindVertexArray(0);
+            counters.vertexArrayBinds++;
+        }
+        if (activeUnit > 0) {
+            glActiveTexture(GL_TEXTURE0);
+            counters.textureUnitChanges++;
+        }
+        items.clear();
+    }
+
+    const RenderStats& stats() const {
+        return counters;
+    }
+
+private:
+    struct Item {
+        unsigned int program;
+        const Shader* shader;
+        const Mesh* mesh;
+        const std::vector<int>* units;
+        MeshLod range;
+    };
+
+    std::vector<Item> items;
+    RenderStats counters;
+
+    // arguments of a multi draw, kept to avoid allocating every frame
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    std::vector<GLint> baseVertices;
+
+    // order of the (unit, texture) pairs an item binds
+    static int compareTextures(const Item& a, const Item& b) {
+        const std::vector<int>& ua = *a.units;
+        const std::vector<int>& ub = *b.units;
+        size_t i = 0, j = 0;
+        while (true) {
+            while (i < ua.size() && ua[i] < 0)
+                i++;
+            while (j < ub.size() && ub[j] < 0)
+                j++;
+            if (i == ua.size() || j == ub.size())
+                return (i == ua.size() ? 0 : 1) - (j == ub.size() ? 0 : 1);
+            if (ua[i] != ub[j])
+                return ua[i] < ub[j] ? -1 : 1;
+            unsigned int ta = a.mesh->textures[i].id, tb = b.mesh->textures[j].id;
+            if (ta != tb)
+                return ta < tb ? -1 : 1;
+            i++;
+            j++;
+        }
+    }
+
+    static bool drawsBefore(const Item& a, const Item& b) {
+        if (a.program != b.program)
+            return a.program < b.program;
+        int textures = compareTextures(a, b);
+        if (textures != 0)
+            return textures < 0;
+        if (!a.mesh->sameVertexDecode(*b.mesh))
+            return decodeBefore(*a.mesh, *b.mesh);
+        if (a.mesh->VAO != b.mesh->VAO)
+            return a.mesh->VAO < b.mesh->VAO;
+        // a multi draw needs one index type
+        return a.mesh->indexType() < b.mesh->indexType();
+    }
+
+    static bool decodeBefore(const Mesh& a, const Mesh& b) {
+        if (a.format != b.format)
+            return a.format < b.format;
+        for (int k = 0; k < 3; k++) {
+            if (a.positionOffset[k] != b.positionOffset[k])
+                return a.positionOffset[k] < b.positionOffset[k];
+            if (a.positionScale[k] != b.positionScale[k])
+                return a.positionScale[k] < b.positionScale[k];
+        }
+        return false;
+    }
+};
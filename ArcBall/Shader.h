@@ -7,9 +7,29 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <vector>
+
+// Location of a uniform, typed by the value it takes
+template <class T>
+struct UniformHandle {
+    GLint location;
+    UniformHandle() : location(-1) {}
+    explicit UniformHandle(GLint location) : location(location) {}
+    bool isValid() const { return location >= 0; }
+};
 
 class Shader {
 public:
+    // An active uniform as reflected after linking
+    struct ActiveUniform {
+        GLenum type;
+        GLint size;
+        GLint location;
+        // texture unit of a sampler, -1 for other uniforms
+        GLint unit;
+    };
+
     unsigned int ID;
     Shader(const char* vertexPath, const char* fragmentPath) {
         std::string vertexCode;
@@ -57,6 +77,7 @@ public:
         glAttachShader(ID, fragment);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        reflectUniforms();
 
         // delete the shaders
         glDeleteShader(vertex);
@@ -64,57 +85,186 @@ public:
 
     }
 
+    // location of an active uniform, -1 if the program has none by that name
+    GLint location(const std::string &name) const {
+        std::map<std::string, ActiveUniform>::const_iterator found = uniforms.find(name);
+        return found == uniforms.end() ? -1 : found->second.location;
+    }
+
+    // texture unit assigned to a sampler at link time, -1 if it is not one
+    GLint samplerUnit(const std::string &name) const {
+        std::map<std::string, ActiveUniform>::const_iterator found = uniforms.find(name);
+        return found == uniforms.end() ? -1 : found->second.unit;
+    }
+
+    const std::map<std::string, ActiveUniform>& activeUniforms() const {
+        return uniforms;
+    }
+
+    // Look a uniform up once and keep the handle, the set() overloads then
+    // cost a single glUniform call. Invalid if missing or of another type.
+    template <class T>
+    UniformHandle<T> uniform(const std::string &name) const {
+        std::map<std::string, ActiveUniform>::const_iterator found = uniforms.find(name);
+        if (found == uniforms.end())
+            return UniformHandle<T>();
+        if (!matchesType(found->second.type, (const T*)NULL)) {
+            std::cout << "uniform " << name << " is not of the requested type" << std::endl;
+            return UniformHandle<T>();
+        }
+        return UniformHandle<T>(found->second.location);
+    }
+
+    void set(UniformHandle<bool> uniform, bool value) const {
+        glUniform1i(uniform.location, (int)value);
+    }
+    void set(UniformHandle<int> uniform, int value) const {
+        glUniform1i(uniform.location, value);
+    }
+    void set(UniformHandle<float> uniform, float value) const {
+        glUniform1f(uniform.location, value);
+    }
+    void set(UniformHandle<glm::vec2> uniform, const glm::vec2 &value) const {
+        glUniform2fv(uniform.location, 1, &value[0]);
+    }
+    void set(UniformHandle<glm::vec3> uniform, const glm::vec3 &value) const {
+        glUniform3fv(uniform.location, 1, &value[0]);
+    }
+    void set(UniformHandle<glm::vec4> uniform, const glm::vec4 &value) const {
+        glUniform4fv(uniform.location, 1, &value[0]);
+    }
+    void set(UniformHandle<glm::mat2> uniform, const glm::mat2 &mat) const {
+        glUniformMatrix2fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
+    void set(UniformHandle<glm::mat3> uniform, const glm::mat3 &mat) const {
+        glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
+    void set(UniformHandle<glm::mat4> uniform, const glm::mat4 &mat) const {
+        glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
+
     // activate the shader
     void use() const {
         glUseProgram(ID);
     }
 
     void setBool(const std::string &name, bool value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(location(name), (int)value);
     }
 
     void setInt(const std::string &name, int value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(location(name), value);
     }
 
     void setFloat(const std::string &name, float value) const {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(location(name), value);
     }
 
     void setVec2(const std::string &name, const glm::vec2 &value) const {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(location(name), 1, &value[0]);
     }
     void setVec2(const std::string &name, float x, float y) const {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2f(location(name), x, y);
     }
 
     void setVec3(const std::string &name, const glm::vec3 &value) const {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(location(name), 1, &value[0]);
     }
     void setVec3(const std::string &name, float x, float y, float z) const {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(location(name), x, y, z);
     }
 
     void setVec4(const std::string &name, const glm::vec4 &value) const {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform4fv(location(name), 1, &value[0]);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) const {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(location(name), x, y, z, w);
     }
 
     void setMat2(const std::string &name, const glm::mat2 &mat) const {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
     void setMat3(const std::string &name, const glm::mat3 &mat) const {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
     void setMat4(const std::string &name, const glm::mat4 &mat) const {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    // active uniforms by name; arrays are listed both as "name" and "name[0]"
+    std::map<std::string, ActiveUniform> uniforms;
+
+    // Read the active uniforms back from the linked program. Every sampler
+    // gets its own texture unit here, once, so meshes only bind textures.
+    void reflectUniforms() {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::string name(maxLength > 0 ? maxLength : 1, '\0');
+
+        GLint previous = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+        glUseProgram(ID);
+        GLint nextUnit = 0;
+        for (GLint i = 0; i < count; i++) {
+            GLsizei length = 0;
+            ActiveUniform uniform;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)name.size(), &length, &uniform.size, &uniform.type, &name[0]);
+            std::string uniformName(name.c_str(), length);
+            uniform.location = glGetUniformLocation(ID, uniformName.c_str());
+            // uniforms in blocks have no location
+            if (uniform.location < 0)
+                continue;
+            uniform.unit = -1;
+            if (isSampler(uniform.type)) {
+                uniform.unit = nextUnit;
+                std::vector<GLint> units(uniform.size);
+                for (GLint k = 0; k < uniform.size; k++)
+                    units[k] = nextUnit++;
+                glUniform1iv(uniform.location, uniform.size, &units[0]);
+            }
+            uniforms[uniformName] = uniform;
+            if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+                uniforms[uniformName.substr(0, uniformName.size() - 3)] = uniform;
+        }
+        glUseProgram((GLuint)previous);
+    }
+
+    static bool isSampler(GLenum type) {
+        switch (type) {
+        case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+        case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY:
+        case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+        case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+        case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW: case GL_SAMPLER_BUFFER:
+        case GL_INT_SAMPLER_1D: case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE:
+        case GL_INT_SAMPLER_1D_ARRAY: case GL_INT_SAMPLER_2D_ARRAY: case GL_INT_SAMPLER_2D_RECT: case GL_INT_SAMPLER_BUFFER:
+        case GL_INT_SAMPLER_2D_MULTISAMPLE: case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+        case GL_UNSIGNED_INT_SAMPLER_1D: case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D:
+        case GL_UNSIGNED_INT_SAMPLER_CUBE: case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+        case GL_UNSIGNED_INT_SAMPLER_2D_RECT: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+        case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE: case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // uniform types each handle type may be set on
+    static bool matchesType(GLenum type, const bool*) { return type == GL_BOOL || type == GL_INT; }
+    static bool matchesType(GLenum type, const int*) { return type == GL_INT || type == GL_BOOL || isSampler(type); }
+    static bool matchesType(GLenum type, const float*) { return type == GL_FLOAT; }
+    static bool matchesType(GLenum type, const glm::vec2*) { return type == GL_FLOAT_VEC2; }
+    static bool matchesType(GLenum type, const glm::vec3*) { return type == GL_FLOAT_VEC3; }
+    static bool matchesType(GLenum type, const glm::vec4*) { return type == GL_FLOAT_VEC4; }
+    static bool matchesType(GLenum type, const glm::mat2*) { return type == GL_FLOAT_MAT2; }
+    static bool matchesType(GLenum type, const glm::mat3*) { return type == GL_FLOAT_MAT3; }
+    static bool matchesType(GLenum type, const glm::mat4*) { return type == GL_FLOAT_MAT4; }
+
     void checkCompileErrors(GLuint shader, std::string type) {
         GLint success;
         GLchar infoLog[1024];
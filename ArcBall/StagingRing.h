@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <cstring>
+
+// Streams data into GL buffers through a fixed size staging buffer split into
+// chunks that are reused round robin. Each chunk is written through an
+// unsynchronized mapped range and copied into place on the GPU with
+// glCopyBufferSubData; a fence per chunk keeps a chunk from being rewritten
+// while its copy is still pending. Upload memory is bounded by
+// chunkSize * chunkCount no matter how large the target buffers are.
+class StagingRing {
+public:
+    static const size_t DefaultChunkSize = 1 << 20;
+    static const unsigned int DefaultChunkCount = 4;
+
+    explicit StagingRing(size_t chunkSize = DefaultChunkSize, unsigned int chunkCount = DefaultChunkCount)
+        : buffer(0), chunk(chunkSize), current(0), fences(chunkCount, (GLsync)0) {
+    }
+
+    ~StagingRing() {
+        for (size_t i = 0; i < fences.size(); i++)
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        if (buffer)
+            glDeleteBuffers(1, &buffer);
+    }
+
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    size_t chunkSize() const {
+        return chunk;
+    }
+
+    // Copy up to one chunk of data into target at offset.
+    // Returns the number of bytes consumed.
+    size_t upload(unsigned int target, size_t offset, const void* data, size_t size) {
+        size_t n = size < chunk ? size : chunk;
+        if (n == 0)
+            return 0;
+
+        if (buffer == 0) {
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glBufferData(GL_COPY_READ_BUFFER, chunk * fences.size(), NULL, GL_STREAM_DRAW);
+        }
+
+        // wait until the GPU has consumed the last copy out of this chunk
+        GLsync& fence = fences[current];
+        if (fence) {
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+                ;
+            glDeleteSync(fence);
+            fence = 0;
+        }
+
+        size_t staged = current * chunk;
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        void* mapped = glMapBufferRange(GL_COPY_READ_BUFFER, staged, n,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+        if (mapped) {
+            memcpy(mapped, data, n);
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged, offset, n);
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        else {
+            // the driver refused the mapping, let it copy the chunk itself
+            glBufferSubData(GL_COPY_WRITE_BUFFER, offset, n, data);
+        }
+
+        current = (current + 1) % fences.size();
+        return n;
+    }
+
+private:
+    unsigned int buffer;
+    size_t chunk;
+    size_t current;
+    std::vector<GLsync> fences;
+};
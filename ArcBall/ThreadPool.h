@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+// Fixed size pool of worker threads fed from a single task queue.
+class ThreadPool {
+public:
+    // threadCount = 0 uses one worker per hardware thread
+    explicit ThreadPool(unsigned int threadCount = 0) : stopping(false) {
+        if (threadCount == 0)
+            threadCount = hardwareThreads();
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCondition.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queue a task, the returned future holds its result (or exception)
+    template <class F>
+    std::future<typename std::result_of<F()>::type> enqueue(F task) {
+        typedef typename std::result_of<F()>::type Result;
+        std::shared_ptr<std::packaged_task<Result()> > packaged = std::make_shared<std::packaged_task<Result()> >(task);
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            tasks.push([packaged]() { (*packaged)(); });
+        }
+        queueCondition.notify_one();
+        return result;
+    }
+
+    unsigned int size() const {
+        return (unsigned int)workers.size();
+    }
+
+    static unsigned int hardwareThreads() {
+        unsigned int count = std::thread::hardware_concurrency();
+        return count == 0 ? 1 : count;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()> > tasks;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    bool stopping;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+// Triangulates the (planar, simple) polygon of a face into corner indices.
+// Convex polygons take a fan; concave ones are ear clipped over index lists,
+// testing candidate ears only against reflex corners picked from a uniform
+// grid, so large n-gons don't degrade to the quadratic "test every corner"
+// case. Scratch buffers are kept between calls.
+class PolygonTriangulator {
+public:
+    // Polygons with at least this many reflex corners get a grid for the ear test
+    static const size_t GridThreshold = 24;
+
+    PolygonTriangulator() : gridSize(0) {
+    }
+
+    // verts[i].Position are the polygon corners in order, triangles are
+    // appended to oIndices as indices into verts with the winding of the polygon
+    template <class V>
+    void triangulate(const std::vector<V>& verts, std::vector<unsigned int>& oIndices) {
+        size_t n = verts.size();
+        if (n < 3)
+            return;
+        if (n == 3) {
+            oIndices.push_back(0);
+            oIndices.push_back(1);
+            oIndices.push_back(2);
+            return;
+        }
+
+        project(verts);
+
+        // Fan fast path for convex polygons (collinear corners are fine)
+        bool convex = true;
+        for (size_t i = 0; i < n && convex; i++)
+            convex = turn(i == 0 ? n - 1 : i - 1, i, i + 1 == n ? 0 : i + 1) >= 0.0f;
+        if (convex) {
+            fan(0, n, oIndices);
+            return;
+        }
+
+        earClip(oIndices);
+    }
+
+private:
+    std::vector<glm::vec2> points;
+    std::vector<unsigned int> prev;
+    std::vector<unsigned int> next;
+
+    // Corners that are reflex before clipping starts, and which of them still are
+    std::vector<unsigned int> reflexCorners;
+    std::vector<unsigned char> reflex;
+    size_t reflexLeft;
+
+    // Grid over the reflex corners, cells stored as one flat array
+    std::vector<unsigned int> cellStart;
+    std::vector<unsigned int> cellItems;
+    std::vector<unsigned int> cellFill;
+    glm::vec2 gridMin;
+    glm::vec2 gridScale;
+    int gridSize;
+
+    // Drop the dominant axis of the Newell normal, mirroring if needed so the
+    // polygon winds counter-clockwise in 2D
+    template <class V>
+    void project(const std::vector<V>& verts) {
+        size_t n = verts.size();
+        glm::vec3 normal(0.0f);
+        for (size_t i = 0; i < n; i++) {
+            const glm::vec3& a = verts[i].Position;
+            const glm::vec3& b = verts[i + 1 == n ? 0 : i + 1].Position;
+            normal.x += (a.y - b.y) * (a.z + b.z);
+            normal.y += (a.z - b.z) * (a.x + b.x);
+            normal.z += (a.x - b.x) * (a.y + b.y);
+        }
+        glm::vec3 an(std::fabs(normal.x), std::fabs(normal.y), std::fabs(normal.z));
+        int u = 0, v = 1;
+        float sign = normal.z;
+        if (an.x >= an.y && an.x >= an.z) {
+            u = 1; v = 2; sign = normal.x;
+        }
+        else if (an.y >= an.z) {
+            u = 2; v = 0; sign = normal.y;
+        }
+
+        points.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            const glm::vec3& p = verts[i].Position;
+            points[i] = glm::vec2(p[u], sign < 0.0f ? -p[v] : p[v]);
+        }
+    }
+
+    // > 0 for a left (convex) turn at b
+    float turn(size_t a, size_t b, size_t c) const {
+        const glm::vec2& pa = points[a];
+        const glm::vec2& pb = points[b];
+        const glm::vec2& pc = points[c];
+        return (pb.x - pa.x) * (pc.y - pb.y) - (pb.y - pa.y) * (pc.x - pb.x);
+    }
+
+    bool insideTriangle(const glm::vec2& q, size_t a, size_t b, size_t c) const {
+        const glm::vec2& pa = points[a];
+        const glm::vec2& pb = points[b];
+        const glm::vec2& pc = points[c];
+        if (q == pa || q == pb || q == pc)
+            return false;
+        return (pb.x - pa.x) * (q.y - pa.y) - (pb.y - pa.y) * (q.x - pa.x) >= 0.0f
+            && (pc.x - pb.x) * (q.y - pb.y) - (pc.y - pb.y) * (q.x - pb.x) >= 0.0f
+            && (pa.x - pc.x) * (q.y - pc.y) - (pa.y - pc.y) * (q.x - pc.x) >= 0.0f;
+    }
+
+    // Clipping only ever turns reflex corners convex, never the other way round
+    void updateReflex(unsigned int i) {
+        if (reflex[i] && turn(prev[i], i, next[i]) >= 0.0f) {
+            reflex[i] = 0;
+            reflexLeft--;
+        }
+    }
+
+    // An ear is a convex corner whose triangle holds no reflex corner
+    bool isEar(unsigned int b) const {
+        unsigned int a = prev[b], c = next[b];
+        if (turn(a, b, c) <= 0.0f)
+            return false;
+
+        if (gridSize == 0) {
+            for (size_t k = 0; k < reflexCorners.size(); k++) {
+                unsigned int q = reflexCorners[k];
+                if (!reflex[q] || q == a || q == c)
+                    continue;
+                if (insideTriangle(points[q], a, b, c))
+                    return false;
+            }
+            return true;
+        }
+
+        const glm::vec2& pa = points[a];
+        const glm::vec2& pb = points[b];
+        const glm::vec2& pc = points[c];
+        glm::vec2 lo(fmin(pa.x, fmin(pb.x, pc.x)), fmin(pa.y, fmin(pb.y, pc.y)));
+        glm::vec2 hi(fmax(pa.x, fmax(pb.x, pc.x)), fmax(pa.y, fmax(pb.y, pc.y)));
+        int x0 = cell(lo.x, 0), x1 = cell(hi.x, 0);
+        int y0 = cell(lo.y, 1), y1 = cell(hi.y, 1);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                int id = y * gridSize + x;
+                for (unsigned int k = cellStart[id]; k < cellStart[id + 1]; k++) {
+                    unsigned int q = cellItems[k];
+                    if (!reflex[q] || q == a || q == c)
+                        continue;
+                    const glm::vec2& pq = points[q];
+                    if (pq.x < lo.x || pq.x > hi.x || pq.y < lo.y || pq.y > hi.y)
+                        continue;
+                    if (insideTriangle(pq, a, b, c))
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    int cell(float value, int axis) const {
+        int c = (int)((value - gridMin[axis]) * gridScale[axis]);
+        return c < 0 ? 0 : (c >= gridSize ? gridSize - 1 : c);
+    }
+
+    int cellOf(unsigned int i) const {
+        return cell(points[i].y, 1) * gridSize + cell(points[i].x, 0);
+    }
+
+    // Find the reflex corners and bucket them if there are many. Corners only
+    // ever go from reflex to convex while clipping, so the grid never grows.
+    void buildGrid() {
+        size_t n = points.size();
+        reflexCorners.clear();
+        reflex.assign(n, 0);
+        for (unsigned int i = 0; i < n; i++) {
+            if (turn(prev[i], i, next[i]) < 0.0f) {
+                reflexCorners.push_back(i);
+                reflex[i] = 1;
+            }
+        }
+        reflexLeft = reflexCorners.size();
+
+        gridSize = 0;
+        if (reflexCorners.size() < GridThreshold)
+            return;
+
+        glm::vec2 lo = points[0], hi = points[0];
+        for (size_t i = 1; i < n; i++) {
+            lo = glm::vec2(fmin(lo.x, points[i].x), fmin(lo.y, points[i].y));
+            hi = glm::vec2(fmax(hi.x, points[i].x), fmax(hi.y, points[i].y));
+        }
+        gridSize = (int)std::sqrt((double)reflexCorners.size()) + 1;
+        gridMin = lo;
+        glm::vec2 extent = hi - lo;
+        gridScale = glm::vec2(extent.x > 0.0f ? gridSize / extent.x : 0.0f, extent.y > 0.0f ? gridSize / extent.y : 0.0f);
+
+        cellStart.assign(gridSize * gridSize + 1, 0);
+        for (size_t k = 0; k < reflexCorners.size(); k++)
+            cellStart[cellOf(reflexCorners[k]) + 1]++;
+        for (int i = 0; i < gridSize * gridSize; i++)
+            cellStart[i + 1] += cellStart[i];
+        cellFill.assign(cellStart.begin(), cellStart.end() - 1);
+        cellItems.resize(reflexCorners.size());
+        for (size_t k = 0; k < reflexCorners.size(); k++)
+            cellItems[cellFill[cellOf(reflexCorners[k])]++] = reflexCorners[k];
+    }
+
+    // Remove a (convex or collinear) corner and re-check its neighbours
+    void unlink(unsigned int i) {
+        unsigned int a = prev[i], c = next[i];
+        next[a] = c;
+        prev[c] = a;
+        updateReflex(a);
+        updateReflex(c);
+    }
+
+    void fan(unsigned int first, size_t count, std::vector<unsigned int>& oIndices) {
+        for (size_t i = 1; i + 1 < count; i++) {
+            oIndices.push_back(first);
+            oIndices.push_back((unsigned int)(first + i));
+            oIndices.push_back((unsigned int)(first + i + 1));
+        }
+    }
+
+    void earClip(std::vector<unsigned int>& oIndices) {
+        size_t n = points.size();
+        prev.resize(n);
+        next.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            prev[i] = (unsigned int)(i == 0 ? n - 1 : i - 1);
+            next[i] = (unsigned int)(i + 1 == n ? 0 : i + 1);
+        }
+        buildGrid();
+
+        size_t left = n;
+        unsigned int cur = 0;
+        size_t misses = 0;
+        while (left > 3) {
+            // Whatever is left once no reflex corner remains is convex
+            if (reflexLeft == 0) {
+                for (unsigned int b = next[cur]; next[b] != cur; b = next[b]) {
+                    oIndices.push_back(cur);
+                    oIndices.push_back(b);
+                    oIndices.push_back(next[b]);
+                }
+                return;
+            }
+
+            if (isEar(cur)) {
+                oIndices.push_back(prev[cur]);
+                oIndices.push_back(cur);
+                oIndices.push_back(next[cur]);
+                unsigned int after = next[cur];
+                unlink(cur);
+                left--;
+                // skip ahead instead of growing a fan around one corner; keeps
+                // the ears (and their grid queries) small
+                cur = next[after];
+                misses = 0;
+                continue;
+            }
+
+            cur = next[cur];
+            if (++misses < left)
+                continue;
+
+            // A full lap without an ear: drop a collinear corner if there is one
+            // (the edge across it still covers it), otherwise the polygon is
+            // degenerate or self intersecting and the rest is fanned.
+            bool dropped = false;
+            for (size_t k = 0; k < left && !dropped; k++, cur = next[cur]) {
+                if (turn(prev[cur], cur, next[cur]) == 0.0f) {
+                    unsigned int after = next[cur];
+                    unlink(cur);
+                    left--;
+                    cur = after;
+                    dropped = true;
+                }
+            }
+            if (!dropped) {
+                unsigned int first = cur;
+                for (unsigned int b = next[first]; next[b] != first; b = next[b]) {
+                    oIndices.push_back(first);
+                    oIndices.push_back(b);
+                    oIndices.push_back(next[b]);
+                }
+                return;
+            }
+            misses = 0;
+        }
+
+        oIndices.push_back(prev[cur]);
+        oIndices.push_back(cur);
+        oIndices.push_back(next[cur]);
+    }
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstring>
+
+// How a Mesh stores its vertices on the GPU
+enum VertexFormat {
+    // Vertex as is: 32 bytes of floats
+    VertexFloat,
+    // PackedVertex: 16 bytes, decoded in vertex.glsl
+    VertexCompact
+};
+
+// Compact vertex layout:
+//  - positions quantized to 16 bits per axis inside a box (positionOffset/positionScale)
+//  - normals octahedral encoded into two signed 16 bit values
+//  - texcoords as half floats
+struct PackedVertex {
+    unsigned short Position[4];   // w is padding
+    short Normal[2];
+    unsigned short TexCoords[2];
+};
+
+namespace vertexpack {
+    inline unsigned short quantize(float value, float offset, float scale) {
+        float t = scale > 0.0f ? (value - offset) / scale : 0.0f;
+        t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+        return (unsigned short)(t * 65535.0f + 0.5f);
+    }
+
+    inline short toSnorm16(float value) {
+        value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+        return (short)std::floor(value * 32767.0f + 0.5f);
+    }
+
+    // Project the unit normal onto the octahedron and unfold its lower half
+    inline void octEncode(const glm::vec3& n, short out[2]) {
+        float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+        if (l1 == 0.0f) {
+            out[0] = 0;
+            out[1] = 0;
+            return;
+        }
+        float x = n.x / l1, y = n.y / l1;
+        if (n.z < 0.0f) {
+            float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = fx;
+            y = fy;
+        }
+        out[0] = toSnorm16(x);
+        out[1] = toSnorm16(y);
+    }
+
+    // IEEE half float, rounded to nearest even
+    inline unsigned short toHalf(float value) {
+        unsigned int bits;
+        memcpy(&bits, &value, sizeof(bits));
+        unsigned int sign = (bits >> 16) & 0x8000u;
+        unsigned int exponent = (bits >> 23) & 0xffu;
+        unsigned int mantissa = bits & 0x7fffffu;
+
+        if (exponent == 0xffu)
+            return (unsigned short)(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+        int e = (int)exponent - 127 + 15;
+        if (e >= 0x1f)
+            return (unsigned short)(sign | 0x7c00u);
+        if (e <= 0) {
+            // subnormal half, or zero
+            if (e < -10)
+                return (unsigned short)sign;
+            mantissa |= 0x800000u;
+            unsigned int shift = (unsigned int)(14 - e);
+            unsigned int half = mantissa >> shift;
+            unsigned int rest = mantissa & ((1u << shift) - 1u);
+            unsigned int middle = 1u << (shift - 1u);
+            if (rest > middle || (rest == middle && (half & 1u)))
+                half++;
+            return (unsigned short)(sign | half);
+        }
+        unsigned int half = ((unsigned int)e << 10) | (mantissa >> 13);
+        unsigned int rest = mantissa & 0x1fffu;
+        if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+            half++;   // may carry into the exponent, which is still correct
+        return (unsigned short)(sign | half);
+    }
+}
@@ -10,10 +10,31 @@
 #include "Model.h"
 #include "Arcball.h"
 
+#include "Triangulator.h"
+
 #include <iostream>
+#include <string>
+#include <chrono>
+#include <random>
+#ifdef ARCBALL_ALLOC_TEST
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#endif
+
+#ifdef _WIN32
+// windows.h comes in through MappedFile.h, with NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
 
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+// seconds per frame spent uploading a model that loads in the background
+const double LOAD_BUDGET = 0.004;
 
 Arcball arcball(SCR_WIDTH, SCR_HEIGHT, 0.5f);
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -50,11 +71,203 @@ void cursorCallback(GLFWwindow *window, double x, double y) {
     arcball.cursorCallback(window, x, y);
 }
 
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#ifdef ARCBALL_ALLOC_TEST
+// Test builds only (define ARCBALL_ALLOC_TEST): every heap allocation of
+// the process is counted, so --alloc-test can check that drawing a frame
+// does not allocate
+std::atomic<size_t> heapAllocations(0);
+
+void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    for (;;) {
+        void* p = std::malloc(size ? size : 1);
+        if (p)
+            return p;
+        // give the new_handler a chance to free memory, as the standard one does
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+#endif
+
+// Largest resident set of the process so far, in bytes
+size_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Time and peak memory of loading the model from its source file (the
+// cache is bypassed) until it is on the GPU
+void benchmarkLoad(const char* path, VertexFormat vertexFormat, bool optimize, bool generateLods,
+    Simple3DS::NormalWeighting normalWeighting) {
+    size_t peakBefore = peakResidentBytes();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Model model(path, false, false, Model::LoadBlocking, vertexFormat, optimize, generateLods, normalWeighting);
+    double seconds = secondsSince(start);
+    size_t peakAfter = peakResidentBytes();
+    size_t triangles = 0;
+    for (size_t i = 0; i < model.meshes.size(); i++)
+        triangles += model.meshes[i].lod(0).indexCount / 3;
+    std::cout << "load: " << seconds * 1000.0 << " ms, " << model.meshes.size() << " meshes, " << triangles << " triangles" << std::endl;
+    std::cout << "peak RSS: " << peakAfter / (1024.0 * 1024.0) << " MB (" << peakBefore / (1024.0 * 1024.0)
+        << " MB before loading)" << std::endl;
+}
+
+// Time per polygon to triangulate synthetic convex and star shaped n-gons,
+// checking that the triangles cover the polygon
+void benchmarkTriangulator() {
+    const char* shapes[2] = { "convex", "star" };
+    const int sizes[] = { 4, 8, 32, 128, 512, 2048 };
+    PolygonTriangulator triangulator;
+    std::vector<unsigned int> indices;
+    for (int shape = 0; shape < 2; shape++) {
+        for (int s = 0; s < int(sizeof(sizes) / sizeof(sizes[0])); s++) {
+            int n = sizes[s];
+            // every other corner of the star is pulled halfway in
+            std::vector<Vertex> polygon(n);
+            float area = 0.0f;
+            for (int i = 0; i < n; i++) {
+                float angle = 6.2831853f * i / n;
+                float radius = shape == 1 && i % 2 ? 0.5f : 1.0f;
+                polygon[i].Position = glm::vec3(radius * std::cos(angle), radius * std::sin(angle), 0.0f);
+            }
+            for (int i = 0; i < n; i++)
+                area += glm::cross(polygon[i].Position, polygon[(i + 1) % n].Position).z * 0.5f;
+
+            int repeats = 200000 / (n * n / 16 + n) + 1;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeats; r++) {
+                indices.clear();
+                triangulator.triangulate(polygon, indices);
+            }
+            double seconds = secondsSince(start) / repeats;
+
+            float covered = 0.0f;
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                const glm::vec3& a = polygon[indices[i]].Position;
+                covered += glm::cross(polygon[indices[i + 1]].Position - a, polygon[indices[i + 2]].Position - a).z * 0.5f;
+            }
+            std::cout << shapes[shape] << " " << n << ": " << seconds * 1000000.0 << " us, " << indices.size() / 3
+                << " triangles, area " << covered << " of " << area << std::endl;
+        }
+    }
+}
+
+#ifdef ARCBALL_ALLOC_TEST
+// Draw frames the way the render loop does, turning the model a little
+// each frame, and count the heap allocations they make; there must be none
+bool testDrawAllocations(Model& model, const Shader& shader) {
+    const int frames = 1000;
+    UniformHandle<glm::mat4> projectionUniform = shader.uniform<glm::mat4>("projection");
+    UniformHandle<glm::mat4> viewUniform = shader.uniform<glm::mat4>("view");
+    UniformHandle<glm::mat4> modelUniform = shader.uniform<glm::mat4>("model");
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
+
+    size_t before = 0;
+    // the first frame is not counted, it may size the render queue
+    for (int frame = -1; frame < frames; frame++) {
+        if (frame == 0)
+            before = heapAllocations.load();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        shader.use();
+        shader.set(projectionUniform, projection);
+        shader.set(viewUniform, view);
+        glm::mat4 modelMatrix = glm::rotate(glm::mat4(1.0f), frame * 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+        modelMatrix = glm::scale(modelMatrix, glm::vec3(0.2f, 0.2f, 0.2f));
+        shader.set(modelUniform, modelMatrix);
+        model.Draw(shader, view * modelMatrix, projection, (float)SCR_HEIGHT);
+        model.Draw(shader);
+    }
+    glFinish();
+    size_t allocations = heapAllocations.load() - before;
+    std::cout << "heap allocations over " << frames << " frames: " << allocations << std::endl;
+    return allocations == 0;
+}
+#endif
+
+// Build times and memory of both hierarchies of the model, serial and on
+// every hardware thread, then the rate of random rays through its bounds
+void benchmarkBvh(Model& model) {
+    const int rays = 100000;
+    std::chrono::steady_clock::time_point start;
+    unsigned int threads[2] = { 1, ThreadPool::hardwareThreads() };
+    for (int i = 0; i < 2; i++) {
+        start = std::chrono::steady_clock::now();
+        model.buildMeshBvh(threads[i]);
+        double meshSeconds = secondsSince(start);
+        start = std::chrono::steady_clock::now();
+        model.buildTriangleBvh(threads[i]);
+        double triangleSeconds = secondsSince(start);
+        std::cout << threads[i] << " thread(s): mesh bvh " << meshSeconds * 1000.0 << " ms, triangle bvh "
+            << triangleSeconds * 1000.0 << " ms" << std::endl;
+    }
+    const Bvh& meshBvh = model.meshBvh();
+    const Bvh& triangleBvh = model.triangleBvh();
+    std::cout << "mesh bvh: " << meshBvh.primitives.size() << " meshes, " << meshBvh.nodes.size() << " nodes, "
+        << meshBvh.memoryBytes() << " bytes" << std::endl;
+    std::cout << "triangle bvh: " << triangleBvh.primitives.size() << " triangles, " << triangleBvh.nodes.size() << " nodes, "
+        << triangleBvh.memoryBytes() << " bytes" << std::endl;
+    if (triangleBvh.empty())
+        return;
+
+    // from a sphere around the model towards points inside its bounds
+    glm::vec3 boxMin = triangleBvh.nodes[0].boundsMin, boxMax = triangleBvh.nodes[0].boundsMax;
+    glm::vec3 centre = (boxMin + boxMax) * 0.5f;
+    float radius = glm::length(boxMax - boxMin);
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int hits = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rays; i++) {
+        glm::vec3 from(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f);
+        glm::vec3 to(unit(random), unit(random), unit(random));
+        glm::vec3 origin = centre + glm::normalize(from) * radius;
+        RayHit hit;
+        if (model.intersect(origin, boxMin + (boxMax - boxMin) * to - origin, hit))
+            hits++;
+    }
+    double seconds = secondsSince(start);
+    std::cout << rays << " rays: " << rays / seconds / 1000000.0 << " Mrays/s, " << hits << " hits" << std::endl;
+}
+
 int main(int argc, char ** argv) {
     if (argc < 2) {
         std::cerr << "Please supply an argument\n";
         return EXIT_FAILURE;
     }
+    // --triangulator-benchmark needs no model (or window)
+    if (std::string(argv[1]) == "--triangulator-benchmark") {
+        benchmarkTriangulator();
+        return EXIT_SUCCESS;
+    }
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -80,7 +293,67 @@ int main(int argc, char ** argv) {
     glEnable(GL_DEPTH_TEST);
 
     Shader ourShader("vertex.glsl", "fragment.glsl");
-    Model ourModel(argv[1]);
+    UniformHandle<glm::mat4> projectionUniform = ourShader.uniform<glm::mat4>("projection");
+    UniformHandle<glm::mat4> viewUniform = ourShader.uniform<glm::mat4>("view");
+    UniformHandle<glm::mat4> modelUniform = ourShader.uniform<glm::mat4>("model");
+    // --compact stores the vertices quantized, at half the GPU memory
+    // --optimize reorders the meshes for the vertex cache
+    // --lod draws distant meshes from simplified levels of detail
+    // --angle-normals weights the normals of a 3DS file by face angle instead of area
+    // --bvh-benchmark reports the bounding volume hierarchies and exits
+    // --load-benchmark reports the load time and peak memory and exits
+    // --alloc-test fails if drawing a frame allocates from the heap (builds
+    //   with ARCBALL_ALLOC_TEST defined only)
+    VertexFormat vertexFormat = VertexFloat;
+    bool optimize = false;
+    bool generateLods = false;
+    Simple3DS::NormalWeighting normalWeighting = Simple3DS::WeightByArea;
+    bool bvhBenchmark = false;
+    bool loadBenchmark = false;
+    bool allocTest = false;
+    for (int i = 2; i < argc; i++) {
+        if (std::string(argv[i]) == "--compact")
+            vertexFormat = VertexCompact;
+        else if (std::string(argv[i]) == "--optimize")
+            optimize = true;
+        else if (std::string(argv[i]) == "--lod")
+            generateLods = true;
+        else if (std::string(argv[i]) == "--angle-normals")
+            normalWeighting = Simple3DS::WeightByAngle;
+        else if (std::string(argv[i]) == "--bvh-benchmark")
+            bvhBenchmark = true;
+        else if (std::string(argv[i]) == "--load-benchmark")
+            loadBenchmark = true;
+        else if (std::string(argv[i]) == "--alloc-test")
+            allocTest = true;
+    }
+    if (allocTest) {
+#ifdef ARCBALL_ALLOC_TEST
+        Model tested(argv[1], false, false, Model::LoadBlocking, vertexFormat, optimize, generateLods, normalWeighting);
+        bool passed = testDrawAllocations(tested, ourShader);
+#else
+        std::cout << "--alloc-test needs a build with ARCBALL_ALLOC_TEST defined" << std::endl;
+        bool passed = false;
+#endif
+        glfwTerminate();
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (loadBenchmark) {
+        benchmarkLoad(argv[1], vertexFormat, optimize, generateLods, normalWeighting);
+        glfwTerminate();
+        return EXIT_SUCCESS;
+    }
+    if (bvhBenchmark) {
+        Model benchmarked(argv[1], false, false, Model::LoadBlocking, vertexFormat, optimize, generateLods, normalWeighting);
+        benchmarkBvh(benchmarked);
+        glfwTerminate();
+        return EXIT_SUCCESS;
+    }
+    // parse off-thread and stream the model in while the window stays responsive
+    Model ourModel(argv[1], false, true, Model::LoadInBackground, vertexFormat, optimize, generateLods, normalWeighting);
+    bool loaded = false;
+    float lastStats = 0.0f;
+    bool rightPressed = false;
    
     while (!glfwWindowShouldClose(window)) {
         float currentFrame = glfwGetTime();
@@ -89,24 +362,56 @@ int main(int argc, char ** argv) {
 
         processInput(window);
 
+        if (!loaded) {
+            // a few milliseconds of GPU uploads per frame
+            loaded = ourModel.update(LOAD_BUDGET);
+            std::string title = "ArcBall";
+            if (!loaded)
+                title += " - loading " + std::to_string((int)(ourModel.loadProgress() * 100.0f)) + "%";
+            glfwSetWindowTitle(window, title.c_str());
+        }
+
         glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         ourShader.use();
 
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        ourShader.setMat4("projection", projection);
+        ourShader.set(projectionUniform, projection);
         glm::mat4 view = camera.GetViewMatrix(); 
         arcball.setViewMatrix(view);
-        ourShader.setMat4("view", view);
+        ourShader.set(viewUniform, view);
 
         glm::mat4 model(1.0f);
         model = glm::translate(model, glm::vec3(0.0f, -1.75f, 0.0f));
         model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
         model = model * arcball.getRotationMatrix();
-        ourShader.setMat4("model", model);
+        ourShader.set(modelUniform, model);
+
+        // meshes outside the view are skipped, levels of detail are picked
+        // by their error in pixels on screen
+        ourModel.Draw(ourShader, view * model, projection, (float)SCR_HEIGHT);
+
+        // right click reports the triangle under the cursor
+        bool rightDown = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+        if (loaded && rightDown && !rightPressed) {
+            double x, y;
+            glfwGetCursorPos(window, &x, &y);
+            RayHit hit;
+            if (ourModel.pick(view * model, projection, (float)x, (float)y, (float)SCR_WIDTH, (float)SCR_HEIGHT, hit))
+                std::cout << "picked mesh " << hit.mesh << ", triangle " << hit.triangle << std::endl;
+        }
+        rightPressed = rightDown;
 
-        ourModel.Draw(ourShader);
+        // show the draw statistics once a second
+        if (loaded && currentFrame - lastStats >= 1.0f) {
+            const RenderStats& stats = ourModel.renderStats();
+            std::string title = "ArcBall - " + std::to_string(stats.meshes) + " visible, " + std::to_string(stats.culled) + " culled, "
+                + std::to_string(stats.triangles) + " triangles, " + std::to_string(stats.draws) + " draws, "
+                + std::to_string(stats.stateChanges()) + " state changes (" + std::to_string(stats.unsortedStateChanges) + " unsorted)";
+            glfwSetWindowTitle(window, title.c_str());
+            lastStats = currentFrame;
+        }
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -4,13 +4,32 @@ layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
 out vec2 TexCoords;
+out vec3 Normal;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// compact vertices (see VertexFormat.h): positions arrive as [0, 1] inside a
+// box, normals as two octahedral coordinates; full float vertices keep the defaults.
+// Always read the normal through Normal, never aNormal directly: the bundled
+// fragment.glsl is unlit, lit fragment shaders get the decoded normal there
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
+uniform bool octahedralNormals = false;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
 void main()
 {
+    vec3 position = positionOffset + aPos * positionScale;
+    Normal = octahedralNormals ? octDecode(aNormal.xy) : aNormal;
     TexCoords = aTexCoords;    
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * model * vec4(position, 1.0);
 }
\ No newline at end of file